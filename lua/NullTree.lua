@@ -6,8 +6,22 @@ local function NullTree()
       numNodes = 1,
       walkTable = walkTable,
       allReduce = function(value) return value, 1 end,
+      allReduceAsync = function(value)
+         return {
+            test = function() return true end,
+            wait = function() return value, 1 end,
+         }
+      end,
+      setAlgorithm = function() end,
+      setChunkSize = function() end,
+      setBucketSize = function() end,
+      reduceScatter = function(value) return value end,
+      allGather = function(value) return value end,
+      gather = function(value) return { value } end,
       scatter = function(value) return value end,
       netStats = function() end,
+      close = function() end,
+      disconnect = function() end,
    }
 end
 
@@ -1,5 +1,6 @@
 local ipc = require 'libipc'
 local walkTable = require 'ipc.utils'.walkTable
+local mapTable = require 'ipc.utils'.mapTable
 
 local function rcsvAllPairs(base, numNodes, index, depth, linkFunc)
    local function link(a, b, d)
@@ -21,6 +22,23 @@ local function rcsvAllPairs(base, numNodes, index, depth, linkFunc)
    end
 end
 
+-- Built in reductions by name, CPU tensors have these fused into the recv
+local reductions = {
+   sum = function(a, b) return torch.isTensor(a) and a:add(b) or a + b end,
+   prod = function(a, b) return torch.isTensor(a) and a:cmul(b) or a * b end,
+   max = function(a, b) return torch.isTensor(a) and a:cmax(b) or math.max(a, b) end,
+   min = function(a, b) return torch.isTensor(a) and a:cmin(b) or math.min(a, b) end,
+}
+
+local function canRecvReduce(value)
+   return torch.isTensor(value) and not torch.typename(value):find('Cuda')
+end
+
+-- The ring overlaps a send with a recv, which needs a flat CPU tensor for sendAsync
+local function canRing(value, numNodes)
+   return canRecvReduce(value) and value:isContiguous() and value:nElement() >= numNodes
+end
+
 local function Tree(nodeIndex, numNodes, base, server, client, host, port, buildTree)
    buildTree = buildTree or rcsvAllPairs
 
@@ -164,6 +182,84 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
    -- ending the allReduce on uneven # of steps per node
    local lastValue
 
+   -- Big contiguous tensors can be cut into 1D chunks that flow through the
+   -- tree as a pipeline, so a deep tree costs about one transfer plus
+   -- depth x chunk instead of depth x the whole tensor
+   local chunkBytes = 0
+   local function setChunkSize(bytes)
+      chunkBytes = bytes or 0
+   end
+
+   local function chunksOf(value)
+      if torch.isTensor(value) and value:isContiguous() then
+         local n = value:nElement()
+         local chunkSize = math.max(1, math.floor(chunkBytes / value:elementSize()))
+         if n > chunkSize then
+            local flat = value:view(n)
+            local chunks = { }
+            for first = 1,n,chunkSize do
+               table.insert(chunks, flat:narrow(1, first, math.min(chunkSize, n - first + 1)))
+            end
+            return chunks
+         end
+      end
+   end
+
+   -- Goes value by value and chunk by chunk, a node sends a reduced chunk
+   -- up while its children are already sending the next one
+   local function reduceUpPipelined(value, reduceFrom)
+      local handles = { }
+      walkTable(value, function(valuei)
+         local chunks = chunksOf(valuei)
+         if not chunks then
+            if server then
+               server:clients(function(client)
+                  valuei = reduceFrom(client, valuei)
+               end)
+            end
+            if client then
+               client:send(valuei)
+            end
+            return valuei
+         end
+         for _,chunk in ipairs(chunks) do
+            if server then
+               server:clients(function(client)
+                  local reduced = reduceFrom(client, chunk)
+                  if reduced ~= chunk then
+                     chunk:copy(reduced)
+                  end
+               end)
+            end
+            if client then
+               table.insert(handles, client:sendAsync(chunk))
+            end
+         end
+      end)
+      for _,handle in ipairs(handles) do
+         handle:wait()
+      end
+   end
+
+   local function mapDownPipelined(value)
+      walkTable(value, function(valuei)
+         local chunks = chunksOf(valuei)
+         for _,chunk in ipairs(chunks or { valuei }) do
+            if client then
+               chunk = client:recv(chunk)
+            end
+            if server then
+               server:clients(function(client)
+                  client:send(chunk)
+               end, 1)
+            end
+            if not chunks then
+               return chunk
+            end
+         end
+      end)
+   end
+
    local function allReduceInner(value, reduce, zero)
       -- Handle uneven endings
       if zero then
@@ -180,37 +276,66 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
       end
       -- Keep track of the number of done nodes
       local numDone = zero and 1 or 0
-      -- Reduce the value up to the root
-      if server then
-         -- Recv from the shortest branch first
-         server:clients(function(client)
-            walkTable(value, function(valuei)
-               return reduce(valuei, client:recv(getTempValue(valuei)))
-            end)
-            numDone = numDone + client:recv()
-         end)
-      end
-      if client then
-         walkTable(value, function(valuei)
-            client:send(valuei)
-         end)
-         client:send(numDone)
-      end
-      -- Map the root value back down the tree
-      if client then
-         walkTable(value, function(valuei)
-            return client:recv(valuei)
-         end)
-         numDone = client:recv()
+      local op = type(reduce) == 'string' and reduce
+      local reduceFn = (op and assert(reductions[op], 'unknown reduction '..op)) or reduce
+      local function reduceFrom(client, valuei)
+         if op and canRecvReduce(valuei) then
+            return client:recvReduce(valuei, op)
+         end
+         return reduceFn(valuei, client:recv(getTempValue(valuei)))
       end
-      if server then
-         -- Send the longest branch first
-         server:clients(function(client)
+      if chunkBytes > 0 then
+         reduceUpPipelined(value, reduceFrom)
+         if server then
+            server:clients(function(client)
+               numDone = numDone + client:recv()
+            end)
+         end
+         if client then
+            client:send(numDone)
+         end
+         mapDownPipelined(value)
+         if client then
+            numDone = client:recv()
+         end
+         if server then
+            server:clients(function(client)
+               client:send(numDone)
+            end, 1)
+         end
+      else
+         -- Reduce the value up to the root
+         if server then
+            -- Recv from the shortest branch first
+            server:clients(function(client)
+               walkTable(value, function(valuei)
+                  return reduceFrom(client, valuei)
+               end)
+               numDone = numDone + client:recv()
+            end)
+         end
+         if client then
             walkTable(value, function(valuei)
                client:send(valuei)
             end)
             client:send(numDone)
-         end, 1) -- Magic bit to invert the client order (longest branch first)
+         end
+         -- Map the root value back down the tree
+         if client then
+            walkTable(value, function(valuei)
+               return client:recv(valuei)
+            end)
+            numDone = client:recv()
+         end
+         if server then
+            -- Send the longest branch first
+            server:clients(function(client)
+               walkTable(value, function(valuei)
+                  client:send(valuei)
+               end)
+               client:send(numDone)
+            end, 1) -- Magic bit to invert the client order (longest branch first)
+         end
       end
       if zero and numDone < numNodes then
          -- If we are done, but not everyone else is, then do it again
@@ -221,15 +346,346 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
       end
    end
 
+   -- Ring connections are only made the first time a ring is used,
+   -- the tree carries everyone's address around
+   local ringServer, ringNext
+   local function connectRing()
+      if ringNext then
+         return
+      end
+      local ringPort
+      ringServer, ringPort = ipc.server(host)
+      local addresses = { }
+      addresses[nodeIndex] = {
+         host = host,
+         port = ringPort,
+      }
+      if server then
+         server:clients(function(client)
+            for i,address in pairs(client:recv()) do
+               addresses[i] = address
+            end
+         end)
+      end
+      if client then
+         client:send(addresses)
+         addresses = client:recv()
+      end
+      if server then
+         server:clients(function(client)
+            client:send(addresses)
+         end, 1)
+      end
+      -- Connecting does not wait for the other side to accept, so nobody deadlocks here
+      local address = addresses[(nodeIndex % numNodes) + 1]
+      ringNext = ipc.client(address.host, address.port)
+      ringServer:clients(1, function(client) end)
+   end
+
+   -- Node i owns chunk i of every ring tensor, the chunks split it evenly
+   local function ringChunk(flat, k)
+      k = k % numNodes
+      local n = flat:nElement()
+      local first = math.floor(k * n / numNodes)
+      return flat:narrow(1, first + 1, math.floor((k + 1) * n / numNodes) - first)
+   end
+
+   -- After N - 1 steps this node holds its own chunk fully reduced
+   local function ringReduceScatterTensor(ringPrev, value, op, reduceFn)
+      local flat = value:view(value:nElement())
+      local rank = nodeIndex - 1
+      for s = 0,numNodes - 2 do
+         local handle = ringNext:sendAsync(ringChunk(flat, rank - s - 1))
+         local recvChunk = ringChunk(flat, rank - s - 2)
+         if op then
+            ringPrev:recvReduce(recvChunk, op)
+         else
+            local reduced = reduceFn(recvChunk, ringPrev:recv(getTempValue(recvChunk)))
+            if reduced ~= recvChunk then
+               recvChunk:copy(reduced)
+            end
+         end
+         handle:wait()
+      end
+      return ringChunk(flat, rank)
+   end
+
+   -- Pass the owned chunks around until everyone has all of them
+   local function ringAllGatherTensor(ringPrev, value)
+      local flat = value:view(value:nElement())
+      local rank = nodeIndex - 1
+      for s = 0,numNodes - 2 do
+         local handle = ringNext:sendAsync(ringChunk(flat, rank - s))
+         ringPrev:recv(ringChunk(flat, rank - s - 1))
+         handle:wait()
+      end
+   end
+
+   -- Reduce-scatter then allgather around the ring, each node sends
+   -- 2 * (N - 1) / N of the tensor no matter how many nodes there are
+   local function ringAllReduceTensor(ringPrev, value, op, reduceFn)
+      ringReduceScatterTensor(ringPrev, value, op, reduceFn)
+      ringAllGatherTensor(ringPrev, value)
+   end
+
+   local function ringAllReduce(value, reduce)
+      connectRing()
+      local op = type(reduce) == 'string' and reduce
+      local reduceFn = (op and assert(reductions[op], 'unknown reduction '..op)) or reduce
+      -- Anything that cannot go around the ring takes the tree
+      local rest = { }
+      local i = 0
+      walkTable(value, function(valuei)
+         i = i + 1
+         if not canRing(valuei, numNodes) then
+            rest[i] = valuei
+         end
+      end)
+      if next(rest) ~= nil then
+         allReduceInner(rest, reduce)
+         lastValue = value
+      end
+      ringServer:clients(function(ringPrev)
+         i = 0
+         walkTable(value, function(valuei)
+            i = i + 1
+            if rest[i] == nil then
+               ringAllReduceTensor(ringPrev, valuei, op, reduceFn)
+            else
+               return rest[i]
+            end
+         end)
+      end)
+      return value, numNodes
+   end
+
+   -- Once a bucket size is set, small tensors are fused into flat buckets (one
+   -- type per bucket, up to bucketBytes each) so a table of many small tensors
+   -- takes a few transfers instead of one per tensor, the buckets are kept while
+   -- the shapes stay the same. Off by default since reduce and zero then see the buckets.
+   local bucketBytes = 0
+   local buckets
+   local function setBucketSize(bytes)
+      bucketBytes = bytes or 0
+      buckets = nil
+   end
+
+   local function planBuckets(value)
+      local plan = { leaves = { }, slots = { }, fused = { }, current = { } }
+      local open = { }
+      walkTable(value, function(valuei)
+         local leaf = { }
+         table.insert(plan.leaves, leaf)
+         if torch.isTensor(valuei) then
+            leaf.type = torch.typename(valuei)
+            leaf.n = valuei:nElement()
+            local bytes = leaf.n * valuei:elementSize()
+            if bytes > 0 and bytes < bucketBytes then
+               local slot = open[leaf.type]
+               if not slot or (slot.n + leaf.n) * valuei:elementSize() > bucketBytes then
+                  slot = { n = 0, members = { }, proto = valuei }
+                  open[leaf.type] = slot
+                  table.insert(plan.slots, slot)
+               end
+               leaf.offset = slot.n + 1
+               slot.n = slot.n + leaf.n
+               table.insert(slot.members, leaf)
+               leaf.slot = #plan.slots
+               return
+            end
+         end
+         table.insert(plan.slots, { })
+         leaf.slot = #plan.slots
+      end)
+      -- A bucket of one is just the tensor itself
+      for _,slot in ipairs(plan.slots) do
+         if slot.members and #slot.members > 1 then
+            slot.buffer = slot.proto.new(slot.n)
+         elseif slot.members then
+            slot.members[1].offset = nil
+         end
+         slot.members = nil
+         slot.proto = nil
+      end
+      return plan
+   end
+
+   local function fuse(value)
+      if bucketBytes <= 0 then
+         return value
+      end
+      -- Reuse the buckets if every leaf has the same type and size as last time
+      local i = 0
+      local numTensors = 0
+      local same = buckets ~= nil
+      walkTable(value, function(valuei)
+         i = i + 1
+         local leaf = same and buckets.leaves[i]
+         if torch.isTensor(valuei) then
+            numTensors = numTensors + 1
+            same = leaf and leaf.type == torch.typename(valuei) and leaf.n == valuei:nElement()
+         else
+            same = leaf and leaf.type == nil
+         end
+      end)
+      if numTensors < 2 then
+         -- Nothing to fuse (uneven endings come through here with an empty value)
+         return value
+      end
+      if not same or i ~= #buckets.leaves then
+         buckets = planBuckets(value)
+      end
+      local current = buckets.current
+      i = 0
+      walkTable(value, function(valuei)
+         i = i + 1
+         current[i] = valuei
+      end)
+      for j,slot in ipairs(buckets.slots) do
+         buckets.fused[j] = slot.buffer
+      end
+      for j,leaf in ipairs(buckets.leaves) do
+         if leaf.offset then
+            buckets.fused[leaf.slot]:narrow(1, leaf.offset, leaf.n):copy(current[j])
+         else
+            buckets.fused[leaf.slot] = current[j]
+         end
+         current[j] = nil
+      end
+      buckets.value = value
+      return buckets.fused
+   end
+
+   local function unfuse(value, fused)
+      local i = 0
+      walkTable(value, function(valuei)
+         i = i + 1
+         local leaf = buckets.leaves[i]
+         if leaf.offset then
+            valuei:copy(fused[leaf.slot]:narrow(1, leaf.offset, leaf.n))
+         else
+            return fused[leaf.slot]
+         end
+      end)
+   end
+
+   -- The tree reduces to the root and back, the ring is bandwidth optimal for big tensors
+   local defaultAlgorithm = 'tree'
+   local function setAlgorithm(algorithm)
+      assert(algorithm == 'tree' or algorithm == 'ring', 'unknown allReduce algorithm '..tostring(algorithm))
+      defaultAlgorithm = algorithm
+   end
+
    -- Classic MPI style all reduce (reduce where all nodes get the final value)
-   local function allReduce(value, reduce, zero)
+   local function allReduce(value, reduce, zero, algorithm)
       -- Support tables of values (as multiple sequential transfers)
       local isTable = type(value) == 'table'
       value = (isTable and value) or { value }
-      local finalValue, numNodes = allReduceInner(value, reduce, zero)
+      algorithm = algorithm or defaultAlgorithm
+      local fused = fuse(value)
+      local finalValue, numNodes
+      -- Uneven endings need the tree to count who is done
+      if algorithm == 'ring' and not zero then
+         finalValue, numNodes = ringAllReduce(fused, reduce)
+      else
+         finalValue, numNodes = allReduceInner(fused, reduce, zero)
+      end
+      -- Nodes that are done get back the last value they fused
+      if buckets and finalValue == buckets.fused then
+         unfuse(buckets.value, finalValue)
+         finalValue = buckets.value
+      end
       return (isTable and finalValue) or finalValue[1], numNodes
    end
 
+   -- The sharded collectives only move flat CPU tensors, around the ring
+   local function checkRingValues(value, name)
+      walkTable(value, function(valuei)
+         assert(canRing(valuei, numNodes), name..' needs contiguous CPU tensors with at least one element per node')
+      end)
+      connectRing()
+   end
+
+   -- Classic MPI style reduce scatter (each node ends up with its own shard of
+   -- the reduced value, node i owns the i-th of numNodes even pieces), the
+   -- shards come back as flat views into the value
+   local function reduceScatter(value, reduce)
+      local isTable = type(value) == 'table'
+      value = (isTable and value) or { value }
+      checkRingValues(value, 'reduceScatter')
+      local op = type(reduce) == 'string' and reduce
+      local reduceFn = (op and assert(reductions[op], 'unknown reduction '..op)) or reduce
+      local shards
+      ringServer:clients(function(ringPrev)
+         shards = mapTable(value, function(valuei)
+            return ringReduceScatterTensor(ringPrev, valuei, op, reduceFn)
+         end)
+      end)
+      return (isTable and shards) or shards[1]
+   end
+
+   -- Classic MPI style allgather (every node's shard to all nodes), each node
+   -- fills in its own shard of the value first, e.g. through reduceScatter's views
+   local function allGather(value)
+      local isTable = type(value) == 'table'
+      value = (isTable and value) or { value }
+      checkRingValues(value, 'allGather')
+      ringServer:clients(function(ringPrev)
+         walkTable(value, function(valuei)
+            ringAllGatherTensor(ringPrev, valuei)
+         end)
+      end)
+      return (isTable and value) or value[1]
+   end
+
+   -- Classic MPI style gather (every node's value to the root), the root gets
+   -- a table of values by nodeIndex and everyone else gets nil
+   local function gather(value)
+      local isTable = type(value) == 'table'
+      value = (isTable and value) or { value }
+      local gathered
+      if not client then
+         gathered = { }
+         gathered[nodeIndex] = value
+      end
+      -- Each link carries nodeIndex and value pairs for the whole subtree, then a 0
+      if client then
+         client:send(nodeIndex)
+         walkTable(value, function(valuei)
+            client:send(valuei)
+         end)
+      end
+      if server then
+         server:clients(function(child)
+            local index = child:recv()
+            while index ~= 0 do
+               if client then
+                  -- Only the root keeps every value, the others pass them through
+                  client:send(index)
+                  walkTable(value, function(valuei)
+                     client:send(child:recv(getTempValue(valuei)))
+                  end)
+               else
+                  gathered[index] = mapTable(value, function(valuei)
+                     return child:recv(torch.isTensor(valuei) and valuei.new():resizeAs(valuei) or nil)
+                  end)
+               end
+               index = child:recv()
+            end
+         end)
+      end
+      if client then
+         client:send(0)
+         return
+      end
+      if not isTable then
+         for i,v in pairs(gathered) do
+            gathered[i] = v[1]
+         end
+      end
+      return gathered
+   end
+
    -- Classic MPI style scatter (root value to all nodes)
    local function scatter(value)
       -- Support tables of tensors
@@ -252,6 +708,137 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
       return (isTable and value) or value[1]
    end
 
+   -- Async allReduces run one at a time, in order, on a communication thread
+   -- with a tree of its own (the main tree only carries the root's address)
+   local asyncQ, asyncMap
+   local numAsync, numAsyncDone, asyncResults = 0, 0, { }
+   local function startAsync()
+      if asyncMap then
+         return
+      end
+      -- Only needs to be unique within this process, every node has its own index and port
+      local name = 'ipc.Tree.async.'..nodeIndex..'.'..tostring(host)..':'..tostring(port)
+      asyncQ = ipc.workqueue(name)
+      asyncMap = ipc.map(1, function(name, nodeIndex, numNodes, base, host, isRoot, buildTree)
+         local ipc = require 'libipc'
+         local Tree = require 'ipc.Tree'
+         local q = ipc.workqueue(name)
+         local tree
+         if isRoot then
+            local server, port = ipc.server(host)
+            q:write(port)
+            tree = Tree(nodeIndex, numNodes, base, server, nil, host, port, buildTree)
+         else
+            local root = q:read()
+            local client = ipc.client(root.host, root.port)
+            tree = Tree(nodeIndex, numNodes, base, nil, client, host, nil, buildTree)
+         end
+         local bucketBytes
+         local broken
+         while true do
+            local job = q:read()
+            if not job then
+               break
+            elseif broken then
+               q:write({ failure = broken })
+            else
+               local ok,ret = pcall(function()
+                  if job.bucketBytes ~= bucketBytes then
+                     bucketBytes = job.bucketBytes
+                     tree.setBucketSize(bucketBytes)
+                  end
+                  tree.setChunkSize(job.chunkBytes)
+                  tree.setAlgorithm(job.algorithm)
+                  return { tree.allReduce(job.value, job.reduce) }
+               end)
+               if ok then
+                  q:write({ success = ret })
+               else
+                  -- A node that drops out mid collective leaves its peers waiting on it,
+                  -- hanging up makes them fail too, and every later job fails the same way
+                  broken = ret
+                  tree.disconnect()
+                  q:write({ failure = ret })
+               end
+            end
+         end
+      end, name, nodeIndex, numNodes, base, host, client == nil, buildTree ~= rcsvAllPairs and buildTree or nil)
+      -- Pass the root's address down the tree
+      local root
+      if client then
+         root = client:recv()
+         asyncQ:write(root)
+      else
+         root = { host = host, port = asyncQ:read() }
+      end
+      if server then
+         server:clients(function(client)
+            client:send(root)
+         end)
+      end
+   end
+
+   local function asyncResult(id, shouldBlock)
+      while numAsyncDone < id do
+         local result = asyncQ:read(shouldBlock ~= true)
+         if not result then
+            return
+         end
+         numAsyncDone = numAsyncDone + 1
+         asyncResults[numAsyncDone] = result
+      end
+      local result = asyncResults[id]
+      asyncResults[id] = nil
+      return result
+   end
+
+   -- Same as allReduce, but returns a handle right away, the tensors in the
+   -- value belong to the communication thread until handle:wait() returns
+   local function allReduceAsync(value, reduce, algorithm)
+      startAsync()
+      numAsync = numAsync + 1
+      local id = numAsync
+      asyncQ:write({
+         value = value,
+         reduce = reduce,
+         algorithm = algorithm or defaultAlgorithm,
+         chunkBytes = chunkBytes,
+         bucketBytes = bucketBytes,
+      })
+      local result
+      local handle = { }
+      function handle:test()
+         result = result or asyncResult(id)
+         return result ~= nil
+      end
+      function handle:wait()
+         result = result or asyncResult(id, true)
+         if result.failure then
+            error(result.failure)
+         end
+         return (unpack or table.unpack)(result.success)
+      end
+      return handle
+   end
+
+   -- Stops the communication thread, every node closes after its last async allReduce
+   local function close()
+      if asyncMap then
+         asyncQ:write(nil)
+         asyncMap:join()
+         asyncMap = nil
+         asyncQ = nil
+      end
+   end
+
+   -- Drops every connection this node holds, peers waiting on it fail instead of hanging
+   local function disconnect()
+      for _,conn in pairs({ ringNext, ringServer, client, server }) do
+         pcall(function() conn:close() end)
+      end
+      ringNext, ringServer, client, server = nil, nil, nil, nil
+   end
+
    -- Handy debug info on network performance
    local function netStats()
       if server then
@@ -260,6 +847,10 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
       if client then
          print(client:netStats())
       end
+      if ringNext then
+         print(ringServer:netStats())
+         print(ringNext:netStats())
+      end
    end
 
    return {
@@ -267,8 +858,17 @@ local function Tree(nodeIndex, numNodes, base, server, client, host, port, build
       numNodes = numNodes,
       walkTable = walkTable,
       allReduce = allReduce,
+      allReduceAsync = allReduceAsync,
+      setAlgorithm = setAlgorithm,
+      setChunkSize = setChunkSize,
+      setBucketSize = setBucketSize,
+      reduceScatter = reduceScatter,
+      allGather = allGather,
+      gather = gather,
       scatter = scatter,
       netStats = netStats,
+      close = close,
+      disconnect = disconnect,
    }
 end
 
@@ -19,6 +19,26 @@ local function walkTable(t, f)
    end
 end
 
+-- Same walk as walkTable, but the results go into a new table of the same shape
+local function mapTable(t, f)
+   local kk = { }
+   for k,_ in pairs(t) do
+      table.insert(kk, k)
+   end
+   table.sort(kk)
+   local mapped = { }
+   for _,k in ipairs(kk) do
+      local tk = t[k]
+      if type(tk) == 'table' then
+         mapped[k] = mapTable(tk, f)
+      else
+         mapped[k] = f(tk)
+      end
+   end
+   return mapped
+end
+
 return {
-   walkTable = walkTable
+   walkTable = walkTable,
+   mapTable = mapTable,
 }
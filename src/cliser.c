@@ -5,24 +5,100 @@
 #include "luaT.h"
 #include <errno.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#ifndef __APPLE__
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+#endif
+#include <sys/un.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CLISER_HAS_F16C
+#endif
 #include "ringbuffer.h"
 #include "serialize.h"
 #include "cliser.h"
 #include "error.h"
 
 #define SEND_RECV_SIZE (16*1024)
+#define MAX_MSG_SIZE ((size_t)1 << 30)
 #define DEFAULT_HOST "127.0.0.1"
+#define UNIX_HOST_PREFIX "unix:"
 #define DEFAULT_TIMEOUT_SECONDS (5*60)
 #define LEN_INVALID 0xFFFFFFFFFFFFFFFFULL
+#ifdef IOV_MAX
+#define CLISER_IOV_MAX (IOV_MAX)
+#else
+#define CLISER_IOV_MAX (1024)
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define CLISER_HAS_ZEROCOPY
+#endif
+#if !defined(__APPLE__) && defined(MFD_CLOEXEC)
+#define CLISER_HAS_SHM
+#endif
+#define SHM_MIN_BYTES (64*1024)
+#define SHM_ROUND_BYTES (1024*1024)
+#define WIRE_FORMAT_NONE (0)
+#define WIRE_FORMAT_FP16 (1)
+#define WIRE_FORMAT_BF16 (2)
+#define WIRE_CHUNK_COUNT (16*1024)
+#define STREAM_MIN_BYTES (1024*1024)
+#define MAX_STREAMS (64)
+#define ACCEPT_THREADS (8)
+// how long a peer that connects and says nothing can tie up an accept thread, and so
+// how long it can hold up server:close(), generous since a real client on a loaded
+// machine can take seconds to answer
+#define HANDSHAKE_TIMEOUT_SECONDS (30)
+#define HIST_SUB_BITS (3)
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+#define OP_SEND (0)
+#define OP_RECV (1)
+#define OP_BROADCAST (2)
+#define OP_RECV_ANY (3)
+#define OP_RECV_ALL (4)
+#define OP_GATHER (5)
+#define NUM_OPS (6)
+#define REDUCE_CHUNK_BYTES (64*1024)
+#define CORK_MAX_BYTES (256*1024)
+#define STRIDED_BLOCK_BYTES (64*1024)
+#define STRIDED_BLOCK_ROWS (1024)
+#define STRIDED_TILE (16)
+#define SPARSE_NONE (0)
+#define SPARSE_ELEMENTS (1)
+#define SPARSE_ROWS (2)
+#define SPARSE_MIN_ELEMENTS (4096)
+#define SPARSE_BLOCK_BYTES (64*1024)
+// a wire chunk in its encoded, float and double forms, also big enough for the reduce and sparse blocks
+#define STAGING_BYTES (WIRE_CHUNK_COUNT * (sizeof(uint16_t) + sizeof(float) + sizeof(double)))
+// a strided block and its row bases sit at the end, clear of the encoded and float wire chunk
+// the block itself goes through, a reduce gathers the local values into the front
+#define STRIDED_BASES_OFFSET (STAGING_BYTES - (STRIDED_BLOCK_ROWS * sizeof(long)))
+#define STRIDED_BLOCK_OFFSET (STRIDED_BASES_OFFSET - STRIDED_BLOCK_BYTES)
+#define SPARSE_INDEX_BYTES(n) ((((n) * sizeof(uint32_t)) + 7) & ~(size_t)7)
+#define CLISER_MAGIC (0x43495043)
+#define CLISER_VERSION (1)
+#define CLISER_MIN_VERSION (1)
+#define CLISER_BYTE_ORDER (0x01020304)
+#define FEATURE_SHM (0x1)
+#define FEATURE_CUDA_IPC (0x2)
+#define FEATURE_WIRE (0x4)
+#define FEATURE_SPARSE (0x8)
 
 typedef struct net_stats_t {
    uint64_t num_bytes;
@@ -34,8 +110,26 @@ typedef struct net_stats_t {
    double cuda_sync_seconds;
    double cuda_ipc_seconds;
    uint64_t cuda_ipc_bytes;
+   uint64_t zerocopy_bytes;
+   uint64_t zerocopy_copied;
+   double shm_seconds;
+   uint64_t shm_bytes;
 } net_stats_t;
 
+// log bucketed, each power of two is split into HIST_SUB_COUNT linear buckets
+typedef struct histogram_t {
+   uint64_t count;
+   uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+// folds count received elements at src into dst
+typedef void (*reduce_fn_t)(void *dst, const void *src, size_t count);
+
+typedef struct op_stats_t {
+   histogram_t latency[NUM_OPS];
+   histogram_t size[NUM_OPS];
+} op_stats_t;
+
 #ifdef USE_CUDA
 typedef struct remote_ptr_t {
    cudaIpcMemHandle_t handle;
@@ -46,6 +140,13 @@ typedef struct remote_ptr_t {
 } remote_ptr_t;
 #endif
 
+typedef struct shm_segment_t {
+   int sock;
+   int is_send;
+   void *ptr;
+   size_t size;
+} shm_segment_t;
+
 typedef struct copy_context_t {
 #ifdef USE_CUDA
    cudaEvent_t event;
@@ -57,8 +158,84 @@ typedef struct copy_context_t {
    net_stats_t tx;
    net_stats_t rx;
    int use_fastpath;
+   int use_shm;
+   shm_segment_t *shm_segments;
+   size_t num_shm_segments;
+   size_t zerocopy_threshold;
+   int can_zerocopy;
+   int wire_format;
+   int use_sparse;
+   uint32_t features;
+   struct stream_t *streams;
+   uint32_t num_streams;
+   op_stats_t *op_stats;
+   void *staging;
 } copy_context_t;
 
+// an extra connection of a striped client, each with its own I/O thread
+typedef struct stream_t {
+   int sock;
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   int running;
+   int busy;
+   int is_send;
+   void *ptr;
+   size_t len;
+   size_t result;
+   copy_context_t copy_context;
+} stream_t;
+
+typedef struct stream_hello_t {
+   uint32_t num_streams;
+   uint32_t index;
+   uint64_t group;
+} stream_hello_t;
+
+typedef struct handshake_t {
+   uint32_t magic;
+   uint32_t byte_order;
+   uint32_t version;
+   uint32_t features;
+} handshake_t;
+
+typedef struct async_op_t {
+   struct async_op_t *next;
+   int is_send;
+   void *header;
+   size_t header_len;
+   void *ptr;
+   size_t len;
+   int use_fastpath;
+   int wire_format;
+   size_t wire_element_size;
+   size_t element_size;
+   size_t row_len;
+   const char *error;
+   int done;
+   int ref_count;
+   pthread_mutex_t mutex;
+   pthread_cond_t done_cond;
+} async_op_t;
+
+typedef struct async_io_t {
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   async_op_t *head;
+   async_op_t *tail;
+   uint32_t pending;
+   int running;
+   int sock;
+   copy_context_t *copy_context;
+} async_io_t;
+
+typedef struct async_handle_t {
+   async_op_t *op;
+   int ref;
+} async_handle_t;
+
 typedef struct client_t {
    int sock;
    struct client_t *next;
@@ -66,17 +243,47 @@ typedef struct client_t {
    ringbuffer_t *send_rb;
    ringbuffer_t *recv_rb;
    copy_context_t copy_context;
+   async_io_t *async_io;
+   stream_t *streams;
+   uint32_t max_streams;
+   uint64_t group;
+   uint32_t version;
+   int handshaking;
+   int corked;
    char *tag;
    int id;
    int ref_count;
+   // a message being read a piece at a time, msg_got counts the length prefix and payload so far
+   size_t msg_len;
+   size_t msg_got;
+   int turn_ready;
 } client_t;
 
 typedef struct server_t {
    int sock;
+#ifndef __APPLE__
+   int epfd;
+   int epoll_failed;
+#endif
    client_t *clients;
    uint32_t num_clients;
    copy_context_t copy_context;
    uint32_t ip_address;
+   char *unix_path;
+   pthread_t accept_threads[ACCEPT_THREADS];
+   int num_accept_threads;
+   int accepting;
+   int wake_fds[2];
+   pthread_mutex_t accept_mutex;
+   pthread_cond_t accept_cond;
+   client_t *joining;
+   client_t *ready;
+   uint32_t num_ready;
+   uint64_t next_group;
+   client_t *last_served;
+#ifdef USE_CUDA
+   int cuda_device;
+#endif
 } server_t;
 
 typedef struct server_client_t {
@@ -85,12 +292,120 @@ typedef struct server_client_t {
 } server_client_t;
 
 static double cliser_profile_seconds() {
-   struct timeval tv;
-   gettimeofday(&tv, NULL);
-   return tv.tv_sec + tv.tv_usec / 1e6;
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// set from lua and read on the async, stream and accept threads
+static int syscall_timing = 1;
+
+// per syscall timing is optional, a zero start means it was off
+static double syscall_seconds() {
+   return THAtomicGet(&syscall_timing) ? cliser_profile_seconds() : 0;
+}
+
+static double syscall_elapsed(double t0) {
+   return t0 ? cliser_profile_seconds() - t0 : 0;
+}
+
+static uint32_t histogram_index(uint64_t value) {
+   if (value < HIST_SUB_COUNT) return (uint32_t)value;
+   uint32_t shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+   return ((shift + 1) << HIST_SUB_BITS) | ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// the largest value that lands in the bucket
+static uint64_t histogram_value(uint32_t index) {
+   uint32_t group = index >> HIST_SUB_BITS;
+   if (group == 0) return index;
+   uint64_t sub = HIST_SUB_COUNT | (index & (HIST_SUB_COUNT - 1));
+   return ((sub + 1) << (group - 1)) - 1;
+}
+
+static void histogram_record(histogram_t *histogram, uint64_t value) {
+   histogram->buckets[histogram_index(value)]++;
+   histogram->count++;
+}
+
+static uint64_t histogram_percentile(histogram_t *histogram, double q) {
+   if (histogram->count == 0) return 0;
+   uint64_t target = (uint64_t)(q * histogram->count);
+   if (target == 0) target = 1;
+   uint64_t seen = 0;
+   for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+      seen += histogram->buckets[i];
+      if (seen >= target) return histogram_value(i);
+   }
+   return histogram_value(HIST_BUCKETS - 1);
+}
+
+typedef struct op_timer_t {
+   copy_context_t *copy_context;
+   int op;
+   double t0;
+   uint64_t tx_bytes;
+   uint64_t rx_bytes;
+} op_timer_t;
+
+static uint64_t net_stats_bytes(net_stats_t *net_stats) {
+   return net_stats->num_bytes + net_stats->shm_bytes + net_stats->cuda_ipc_bytes;
+}
+
+static void op_timer_start(op_timer_t *timer, copy_context_t *copy_context, int op) {
+   timer->copy_context = copy_context;
+   timer->op = op;
+   timer->tx_bytes = net_stats_bytes(&copy_context->tx);
+   timer->rx_bytes = net_stats_bytes(&copy_context->rx);
+   timer->t0 = cliser_profile_seconds();
+}
+
+static void op_timer_stop(op_timer_t *timer) {
+   double seconds = cliser_profile_seconds() - timer->t0;
+   copy_context_t *copy_context = timer->copy_context;
+   int is_send = timer->op == OP_SEND || timer->op == OP_BROADCAST;
+   net_stats_t *net_stats = is_send ? &copy_context->tx : &copy_context->rx;
+   net_stats->total_seconds += seconds;
+   net_stats->num_calls++;
+   if (!copy_context->op_stats) {
+      copy_context->op_stats = (op_stats_t *)calloc(1, sizeof(op_stats_t));
+      if (!copy_context->op_stats) return;
+   }
+   uint64_t bytes = net_stats_bytes(net_stats) - (is_send ? timer->tx_bytes : timer->rx_bytes);
+   histogram_record(&copy_context->op_stats->latency[timer->op], (uint64_t)(seconds * 1e9));
+   histogram_record(&copy_context->op_stats->size[timer->op], bytes);
+}
+
+// MSG_ZEROCOPY needs SO_ZEROCOPY on the socket, it is set once when zero copy gets turned on
+static int enable_zerocopy(client_t *client) {
+#ifdef CLISER_HAS_ZEROCOPY
+   if (!client->copy_context.can_zerocopy) {
+      int one = 1;
+      client->copy_context.can_zerocopy = setsockopt(client->sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+   }
+   return client->copy_context.can_zerocopy;
+#else
+   (void)client;
+   return 0;
+#endif
 }
 
 static void insert_client(server_t *server, client_t *client) {
+   if (server->copy_context.zerocopy_threshold) {
+      enable_zerocopy(client);
+   }
+#ifndef __APPLE__
+   // register once, recvAny only ever sees the sockets that are ready
+   struct epoll_event event;
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN;
+   event.data.ptr = client;
+   if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, client->sock, &event)) {
+      // a client epoll cannot see would never show up in recvAny, poll them all instead
+      fprintf(stderr, "WARN: torch-ipc: failed to register client with epoll (%s), falling back to poll\n", strerror(errno));
+      server->epoll_failed = 1;
+   }
+#endif
    if (server->clients) {
       server->clients->prev = client;
       client->next = server->clients;
@@ -100,6 +415,16 @@ static void insert_client(server_t *server, client_t *client) {
 }
 
 static void remove_client(server_t *server, client_t *client) {
+#ifndef __APPLE__
+   // ENOENT just means the client never made it into the epoll set
+   struct epoll_event event;
+   if (epoll_ctl(server->epfd, EPOLL_CTL_DEL, client->sock, &event) && errno != ENOENT) {
+      fprintf(stderr, "WARN: torch-ipc: failed to remove client from epoll (%s)\n", strerror(errno));
+   }
+#endif
+   if (server->last_served == client) {
+      server->last_served = client->prev;
+   }
    if (server->clients == client) {
       server->clients = client->next;
    }
@@ -112,7 +437,30 @@ static void remove_client(server_t *server, client_t *client) {
    server->num_clients--;
 }
 
+static void release_shm_segments(copy_context_t *copy_context, int sock) {
+   size_t i = 0;
+   while (i < copy_context->num_shm_segments) {
+      shm_segment_t *segment = &copy_context->shm_segments[i];
+      if (sock < 0 || segment->sock == sock) {
+         munmap(segment->ptr, segment->size);
+         copy_context->num_shm_segments--;
+         memmove(segment, segment + 1, (copy_context->num_shm_segments - i) * sizeof(shm_segment_t));
+         continue;
+      }
+      i++;
+   }
+   if (copy_context->num_shm_segments == 0 && copy_context->shm_segments) {
+      free(copy_context->shm_segments);
+      copy_context->shm_segments = NULL;
+   }
+}
+
 static void destroy_copy_context(copy_context_t *copy_context) {
+   release_shm_segments(copy_context, -1);
+   free(copy_context->op_stats);
+   copy_context->op_stats = NULL;
+   free(copy_context->staging);
+   copy_context->staging = NULL;
 #ifdef USE_CUDA
    if (copy_context->event) {
       THCudaCheck(cudaEventDestroy(copy_context->event));
@@ -123,13 +471,22 @@ static void destroy_copy_context(copy_context_t *copy_context) {
       copy_context->buf[0] = NULL;
       copy_context->buf[1] = NULL;
    }
-#else
-   (void)copy_context;
 #endif
 }
 
+static void destroy_async_io(client_t *client);
+static int add_stream(client_t *client, int sock);
+static int start_accepting(server_t *server);
+static void stop_accepting(server_t *server);
+static void destroy_streams(client_t *client);
+
 static int destroy_client(lua_State *L, client_t *client) {
+   destroy_async_io(client);
+   destroy_streams(client);
    if (client->sock) {
+      if (client->send_rb && ringbuffer_peek(client->send_rb)) {
+         send(client->sock, ringbuffer_buf_ptr(client->send_rb), ringbuffer_peek(client->send_rb), 0);
+      }
       size_t msg = LEN_INVALID;
       send(client->sock, &msg, sizeof(msg), 0);
       int ret = close(client->sock);
@@ -153,12 +510,25 @@ static int destroy_client(lua_State *L, client_t *client) {
    return 0;
 }
 
+// safe to call more than once, close() and __gc both end up here
 static int destroy_server(lua_State *L, server_t *server) {
+   stop_accepting(server);
+   int err = 0;
    if (server->sock) {
-      int ret = close(server->sock);
-      if (ret) return LUA_HANDLE_ERROR(L, errno);
+      if (close(server->sock)) err = errno;
       server->sock = 0;
    }
+   if (server->unix_path) {
+      unlink(server->unix_path);
+      free(server->unix_path);
+      server->unix_path = NULL;
+   }
+#ifndef __APPLE__
+   if (server->epfd) {
+      close(server->epfd);
+      server->epfd = 0;
+   }
+#endif
    client_t *client = server->clients;
    while (client) {
       client_t *next = client->next;
@@ -168,10 +538,33 @@ static int destroy_server(lua_State *L, server_t *server) {
    server->clients = NULL;
    server->num_clients = 0;
    destroy_copy_context(&server->copy_context);
+   if (err) return LUA_HANDLE_ERROR(L, err);
+   return 0;
+}
+
+static int is_unix_host(const char *host) {
+   return strncmp(host, UNIX_HOST_PREFIX, strlen(UNIX_HOST_PREFIX)) == 0;
+}
+
+// "unix:/path" is a filesystem socket, "unix:@name" lives in the abstract namespace
+static int get_unix_sockaddr(lua_State *L, const char *host, struct sockaddr *addr, socklen_t *addrlen) {
+   const char *path = host + strlen(UNIX_HOST_PREFIX);
+   struct sockaddr_un *sun = (struct sockaddr_un *)addr;
+   size_t len = strlen(path);
+   if (len == 0 || len >= sizeof(sun->sun_path)) return LUA_HANDLE_ERROR_STR(L, "unix socket path is empty or too long");
+   if (*addrlen < sizeof(struct sockaddr_un)) return LUA_HANDLE_ERROR(L, ENOMEM);
+   memset(sun, 0, sizeof(struct sockaddr_un));
+   sun->sun_family = AF_UNIX;
+   memcpy(sun->sun_path, path, len);
+   if (path[0] == '@') {
+      sun->sun_path[0] = 0;
+   }
+   *addrlen = offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1);
    return 0;
 }
 
 static int get_sockaddr(lua_State *L, const char *host, const char *port, struct sockaddr *addr, socklen_t *addrlen) {
+   if (is_unix_host(host)) return get_unix_sockaddr(L, host, addr, addrlen);
    struct addrinfo hints;
    memset(&hints, 0, sizeof(hints));
    hints.ai_family = AF_INET;
@@ -190,7 +583,16 @@ static int get_sockaddr(lua_State *L, const char *host, const char *port, struct
    return 0;
 }
 
-static void configure_socket(int sock) {
+// unix sockets are always local, report them all as the same host
+static uint32_t sockaddr_host(struct sockaddr *addr) {
+   if (addr->sa_family == AF_INET) {
+      return ((struct sockaddr_in *)addr)->sin_addr.s_addr;
+   }
+   return 0;
+}
+
+static void configure_socket(int sock, int family) {
+   if (family != AF_INET) return;
    int value = 1;
    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(int));
 #ifndef __APPLE__
@@ -213,14 +615,19 @@ int cliser_server(lua_State *L) {
    int port = luaL_optinteger(L, 2, 0);
    char port_str[16];
    snprintf(port_str, 16, "%d", port);
-   struct sockaddr addr;
-   socklen_t addrlen = sizeof(struct sockaddr);
-   int ret = get_sockaddr(L, host, port != 0 ? port_str : NULL, &addr, &addrlen);
+   struct sockaddr_storage addr;
+   socklen_t addrlen = sizeof(addr);
+   int ret = get_sockaddr(L, host, port != 0 ? port_str : NULL, (struct sockaddr *)&addr, &addrlen);
    if (ret) return ret;
-   ret = socket(PF_INET, SOCK_STREAM, 0);
+   int family = addr.ss_family;
+   if (family == AF_UNIX && host[strlen(UNIX_HOST_PREFIX)] != '@') {
+      // clear out a stale socket left behind by a previous run
+      unlink(((struct sockaddr_un *)&addr)->sun_path);
+   }
+   ret = socket(family, SOCK_STREAM, 0);
    if (ret <= 0) return LUA_HANDLE_ERROR(L, errno);
    int sock = ret;
-   ret = bind(sock, &addr, addrlen);
+   ret = bind(sock, (struct sockaddr *)&addr, addrlen);
    if (ret) {
       close(sock);
       return LUA_HANDLE_ERROR(L, errno);
@@ -230,51 +637,77 @@ int cliser_server(lua_State *L) {
       close(sock);
       return LUA_HANDLE_ERROR(L, errno);
    }
-   struct sockaddr_in sin;
-   addrlen = sizeof(struct sockaddr_in);
-   ret = getsockname(sock, (struct sockaddr *)&sin, &addrlen);
-   if (ret) {
+   uint32_t ip_address = 0;
+   if (family == AF_INET) {
+      struct sockaddr_in sin;
+      addrlen = sizeof(struct sockaddr_in);
+      ret = getsockname(sock, (struct sockaddr *)&sin, &addrlen);
+      if (ret) {
+         close(sock);
+         return LUA_HANDLE_ERROR(L, errno);
+      }
+      port = ntohs(sin.sin_port);
+      ip_address = sin.sin_addr.s_addr;
+   } else {
+      port = 0;
+   }
+#ifndef __APPLE__
+   ret = epoll_create1(EPOLL_CLOEXEC);
+   if (ret < 0) {
       close(sock);
       return LUA_HANDLE_ERROR(L, errno);
    }
-   port = ntohs(sin.sin_port);
+   int epfd = ret;
+#endif
    server_t *server = (server_t *)lua_newuserdata(L, sizeof(server_t));
    memset(server, 0, sizeof(server_t));
    server->sock = sock;
-   server->ip_address = sin.sin_addr.s_addr;
+#ifndef __APPLE__
+   server->epfd = epfd;
+#endif
+   server->ip_address = ip_address;
+   if (family == AF_UNIX && host[strlen(UNIX_HOST_PREFIX)] != '@') {
+      server->unix_path = strdup(((struct sockaddr_un *)&addr)->sun_path);
+   }
+#ifdef USE_CUDA
+   if (cudaGetDevice(&server->cuda_device) != cudaSuccess) {
+      cudaGetLastError();
+      server->cuda_device = -1;
+   }
+#endif
+   ret = start_accepting(server);
+   if (ret) {
+      destroy_server(L, server);
+      return LUA_HANDLE_ERROR(L, ret);
+   }
    luaL_getmetatable(L, "ipc.server");
    lua_setmetatable(L, -2);
    lua_pushinteger(L, port);
    return 2;
 }
 
-static int can_use_fastpath(lua_State *L, int sock, uint32_t bind_addr, uint32_t addr) {
+// handshakes run on the accept threads too, so they report failure with -1
+// instead of raising a lua error, the caller owns the socket
+static int can_use_fastpath(int sock, uint32_t bind_addr, uint32_t addr) {
 #if defined(USE_CUDA) && !defined(__APPLE__)
    if (bind_addr == addr) {
       int device;
       cudaError_t err = cudaGetDevice(&device);
       if (err != cudaSuccess) {
-         if (err == cudaErrorNoDevice) {
-            cudaGetLastError();
-            return 0;
-         } else {
-            THCudaCheck(err);
-         }
+         cudaGetLastError();
+         return 0;
       }
       int ret = send(sock, &device, sizeof(device), 0);
-      if (ret < 0) {
-         close(sock);
-         return LUA_HANDLE_ERROR(L, errno);
-      }
+      if (ret < 0) return -1;
       int remote_device;
-      ret = recv(sock, &remote_device, sizeof(remote_device), 0);
-      if (ret <= 0) {
-         close(sock);
-         return LUA_HANDLE_ERROR(L, errno);
-      }
+      ret = recv(sock, &remote_device, sizeof(remote_device), MSG_WAITALL);
+      if (ret <= 0) return -1;
       if (device != remote_device) {
-         int can;
-         THCudaCheck(cudaDeviceCanAccessPeer(&can, device, remote_device));
+         int can = 0;
+         if (cudaDeviceCanAccessPeer(&can, device, remote_device) != cudaSuccess) {
+            cudaGetLastError();
+            can = 0;
+         }
          if (can) {
             cudaError_t err = cudaDeviceEnablePeerAccess(remote_device, 0);
             if (err == cudaSuccess || err == cudaErrorPeerAccessAlreadyEnabled) {
@@ -290,7 +723,6 @@ static int can_use_fastpath(lua_State *L, int sock, uint32_t bind_addr, uint32_t
       }
    }
 #else
-   (void)L;
    (void)sock;
    (void)bind_addr;
    (void)addr;
@@ -298,6 +730,297 @@ static int can_use_fastpath(lua_State *L, int sock, uint32_t bind_addr, uint32_t
    return 0;
 }
 
+static uint32_t local_features(int family) {
+   uint32_t features = FEATURE_WIRE | FEATURE_SPARSE;
+#ifdef CLISER_HAS_SHM
+   if (family == AF_UNIX) features |= FEATURE_SHM;
+#else
+   (void)family;
+#endif
+#if defined(USE_CUDA) && !defined(__APPLE__)
+   features |= FEATURE_CUDA_IPC;
+#endif
+   return features;
+}
+
+// both ends send what they speak and settle on the lowest version and the
+// features they have in common, -1 is an i/o failure, -2 and -3 a peer we
+// cannot talk to
+static int exchange_handshake(int sock, int family, uint32_t *features, uint32_t *version) {
+   handshake_t local;
+   local.magic = CLISER_MAGIC;
+   local.byte_order = CLISER_BYTE_ORDER;
+   local.version = CLISER_VERSION;
+   local.features = local_features(family);
+   int ret = send(sock, &local, sizeof(local), 0);
+   if (ret != sizeof(local)) return -1;
+   handshake_t remote;
+   ret = recv(sock, &remote, sizeof(remote), MSG_WAITALL);
+   if (ret != sizeof(remote)) return -1;
+   // tensors go over the wire in host order, so both ends must agree on it
+   if (remote.byte_order != CLISER_BYTE_ORDER) return -2;
+   if (remote.magic != CLISER_MAGIC || remote.version < CLISER_MIN_VERSION) return -3;
+   *version = remote.version < local.version ? remote.version : local.version;
+   *features = local.features & remote.features;
+   return 0;
+}
+
+static const char *handshake_error(int ret) {
+   if (ret == -2) return "remote host has a different byte order";
+   if (ret == -3) return "remote host speaks an unsupported protocol version";
+   return "handshake failed";
+}
+
+// the sock is already closed, so destroy_client has nothing to raise about
+static void discard_client(client_t *client) {
+   close(client->sock);
+   client->sock = 0;
+   destroy_client(NULL, client);
+}
+
+static void clear_handshake_timeout(int sock) {
+   struct timeval tv;
+   memset(&tv, 0, sizeof(tv));
+   setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// hands a client over to server:clients() once its handshake is finished and
+// all of its streams have arrived, the accept mutex must be held
+static void client_joined(server_t *server, client_t *client) {
+   if (client->handshaking || client->copy_context.num_streams < client->max_streams) return;
+   client_t **prev = &server->joining;
+   while (*prev != client) {
+      prev = &(*prev)->next;
+   }
+   *prev = client->next;
+   client->next = server->ready;
+   server->ready = client;
+   server->num_ready++;
+   pthread_cond_broadcast(&server->accept_cond);
+}
+
+static void accept_connection(server_t *server, int sock, struct sockaddr_storage *addr) {
+   configure_socket(sock, addr->ss_family);
+   // a peer that connects and then says nothing must not hold up server:close()
+   struct timeval tv;
+   tv.tv_sec = HANDSHAKE_TIMEOUT_SECONDS;
+   tv.tv_usec = 0;
+   setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+   // the versioned handshake goes first on every connection, before anything
+   // whose layout could change between versions
+   uint32_t features = 0;
+   uint32_t version = 0;
+   if (exchange_handshake(sock, addr->ss_family, &features, &version) != 0) {
+      close(sock);
+      return;
+   }
+   stream_hello_t hello;
+   int ret = recv(sock, &hello, sizeof(hello), MSG_WAITALL);
+   if (ret != sizeof(hello) || hello.num_streams < 1 || hello.num_streams > MAX_STREAMS || hello.index >= hello.num_streams) {
+      close(sock);
+      return;
+   }
+   if (hello.index > 0) {
+      // an extra stream, attach it to the client that opened stream 0
+      pthread_mutex_lock(&server->accept_mutex);
+      client_t *client = server->joining;
+      while (client && client->group != hello.group) {
+         client = client->next;
+      }
+      if (client && client->copy_context.num_streams < client->max_streams) {
+         clear_handshake_timeout(sock);
+         if (add_stream(client, sock) == 0) {
+            client_joined(server, client);
+            sock = -1;
+         }
+      }
+      pthread_mutex_unlock(&server->accept_mutex);
+      if (sock >= 0) close(sock);
+      return;
+   }
+   client_t *client = (client_t *)calloc(1, sizeof(client_t));
+   client->sock = sock;
+   client->send_rb = ringbuffer_create(SEND_RECV_SIZE);
+   client->recv_rb = ringbuffer_create(SEND_RECV_SIZE);
+   client->handshaking = 1;
+   if (hello.num_streams > 1) {
+      client->max_streams = hello.num_streams - 1;
+      client->streams = (stream_t *)calloc(client->max_streams, sizeof(stream_t));
+      client->copy_context.streams = client->streams;
+   }
+   // register before the client learns its group, its extra streams may land on other threads right away
+   pthread_mutex_lock(&server->accept_mutex);
+   client->group = ++server->next_group;
+   client->next = server->joining;
+   server->joining = client;
+   pthread_mutex_unlock(&server->accept_mutex);
+   uint64_t group = client->group;
+   int use_fastpath = -1;
+   if (send(sock, &group, sizeof(group), 0) == sizeof(group)) {
+      use_fastpath = (features & FEATURE_CUDA_IPC) ? can_use_fastpath(sock, server->ip_address, sockaddr_host((struct sockaddr *)addr)) : 0;
+   }
+   pthread_mutex_lock(&server->accept_mutex);
+   if (use_fastpath < 0) {
+      client_t **prev = &server->joining;
+      while (*prev != client) {
+         prev = &(*prev)->next;
+      }
+      *prev = client->next;
+      pthread_mutex_unlock(&server->accept_mutex);
+      discard_client(client);
+      return;
+   }
+   clear_handshake_timeout(sock);
+   client->copy_context.use_fastpath = use_fastpath;
+   client->copy_context.use_shm = (features & FEATURE_SHM) != 0;
+   client->copy_context.features = features;
+   client->version = version;
+   client->handshaking = 0;
+   client_joined(server, client);
+   pthread_mutex_unlock(&server->accept_mutex);
+}
+
+// every accept thread polls the same non-blocking listen socket and runs the
+// handshake for whatever it accepts, so slow handshakes do not queue up
+static void *accept_thread(void *arg) {
+   server_t *server = (server_t *)arg;
+#ifdef USE_CUDA
+   if (server->cuda_device >= 0) {
+      cudaSetDevice(server->cuda_device);
+   }
+#endif
+   while (1) {
+      struct pollfd fds[2];
+      fds[0].fd = server->sock;
+      fds[0].events = POLLIN;
+      fds[0].revents = 0;
+      fds[1].fd = server->wake_fds[0];
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+      int ret = poll(fds, 2, -1);
+      if (ret < 0) {
+         if (errno == EINTR) continue;
+         break;
+      }
+      if (fds[1].revents) break;
+      if (!(fds[0].revents & POLLIN)) continue;
+      struct sockaddr_storage addr;
+      socklen_t addrlen = sizeof(addr);
+      int sock = accept(server->sock, (struct sockaddr *)&addr, &addrlen);
+      if (sock < 0) {
+         // another thread won the race, anything else (out of fds) gets a short back off
+         if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+            usleep(10 * 1000);
+         }
+         continue;
+      }
+      int flags = fcntl(sock, F_GETFL, 0);
+      fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+      accept_connection(server, sock, &addr);
+   }
+   return NULL;
+}
+
+static int start_accepting(server_t *server) {
+   int flags = fcntl(server->sock, F_GETFL, 0);
+   if (fcntl(server->sock, F_SETFL, flags | O_NONBLOCK)) return errno;
+   pthread_mutex_init(&server->accept_mutex, NULL);
+   pthread_cond_init(&server->accept_cond, NULL);
+   server->accepting = 1;
+   return 0;
+}
+
+// the accept threads start with the first server:clients() that waits for someone,
+// one per client still expected up to ACCEPT_THREADS, so the many servers that
+// only ever take a client or two (tree nodes, rings) stay cheap
+static int add_accept_threads(server_t *server, uint32_t expected) {
+   int wanted = (expected < ACCEPT_THREADS) ? (int)expected : ACCEPT_THREADS;
+   if (server->num_accept_threads >= wanted) return 0;
+   if (!server->num_accept_threads && pipe(server->wake_fds)) return errno;
+   while (server->num_accept_threads < wanted) {
+      int ret = pthread_create(&server->accept_threads[server->num_accept_threads], NULL, accept_thread, server);
+      if (ret) {
+         // fewer threads only means handshakes take turns
+         if (server->num_accept_threads) break;
+         close(server->wake_fds[0]);
+         close(server->wake_fds[1]);
+         return ret;
+      }
+      server->num_accept_threads++;
+   }
+   return 0;
+}
+
+static void stop_accepting(server_t *server) {
+   if (!server->accepting) return;
+   server->accepting = 0;
+   if (server->num_accept_threads) {
+      uint8_t wake = 1;
+      if (write(server->wake_fds[1], &wake, sizeof(wake)) != sizeof(wake)) {
+         fprintf(stderr, "WARN: torch-ipc: failed to wake the accept threads\n");
+      }
+      for (int i = 0; i < server->num_accept_threads; i++) {
+         pthread_join(server->accept_threads[i], NULL);
+      }
+      server->num_accept_threads = 0;
+      close(server->wake_fds[0]);
+      close(server->wake_fds[1]);
+   }
+   client_t *lists[2] = { server->joining, server->ready };
+   for (int i = 0; i < 2; i++) {
+      client_t *client = lists[i];
+      while (client) {
+         client_t *next = client->next;
+         discard_client(client);
+         client = next;
+      }
+   }
+   server->joining = NULL;
+   server->ready = NULL;
+   server->num_ready = 0;
+   pthread_mutex_destroy(&server->accept_mutex);
+   pthread_cond_destroy(&server->accept_cond);
+}
+
+// these return an errno instead of raising, so cliser_client can clean up first
+static int connect_socket(struct sockaddr_storage *addr, socklen_t addrlen, int *sockp) {
+   int family = addr->ss_family;
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   time_t t = tv.tv_sec + DEFAULT_TIMEOUT_SECONDS;
+   int sock = -1;
+   int ret = -1;
+   while (tv.tv_sec < t) {
+      ret = socket(family, SOCK_STREAM, 0);
+      if (ret <= 0) return errno;
+      sock = ret;
+      configure_socket(ret, family);
+      ret = connect(sock, (struct sockaddr *)addr, addrlen);
+      if (!ret) break;
+      close(sock);
+      sleep(1);
+      gettimeofday(&tv, NULL);
+   }
+   if (ret) {
+      int err = errno;
+      close(sock);
+      return err;
+   }
+   *sockp = sock;
+   return 0;
+}
+
+// the caller still owns the socket when this fails
+static int send_stream_hello(int sock, uint32_t num_streams, uint32_t index, uint64_t group) {
+   stream_hello_t hello;
+   hello.num_streams = num_streams;
+   hello.index = index;
+   hello.group = group;
+   int ret = send(sock, &hello, sizeof(hello), 0);
+   if (ret != sizeof(hello)) return (ret < 0) ? errno : EIO;
+   return 0;
+}
+
 int cliser_client(lua_State *L) {
 #ifdef USE_CUDA
    // sometimes cutorch is loaded late, this is a good spot to try and register...
@@ -305,50 +1028,101 @@ int cliser_client(lua_State *L) {
 #endif
    const char *host;
    const char *port;
+   int oi;
    if (lua_type(L, 1) == LUA_TSTRING) {
       host = lua_tostring(L, 1);
       port = lua_tostring(L, 2);
+      oi = 3;
    } else {
       host = DEFAULT_HOST;
       port = lua_tostring(L, 1);
+      oi = 2;
    }
-   socklen_t addrlen = sizeof(struct sockaddr);
-   struct sockaddr addr;
-   int ret = get_sockaddr(L, host, port, &addr, &addrlen);
+   uint32_t num_streams = 1;
+   if (lua_type(L, oi) == LUA_TTABLE) {
+      lua_getfield(L, oi, "streams");
+      num_streams = luaL_optinteger(L, -1, 1);
+      lua_pop(L, 1);
+      if (num_streams < 1 || num_streams > MAX_STREAMS) return LUA_HANDLE_ERROR_STR(L, "streams must be between 1 and 64");
+   }
+   struct sockaddr_storage addr;
+   socklen_t addrlen = sizeof(addr);
+   int ret = get_sockaddr(L, host, port, (struct sockaddr *)&addr, &addrlen);
    if (ret) return ret;
-   struct timeval tv;
-   gettimeofday(&tv, NULL);
-   time_t t = tv.tv_sec + DEFAULT_TIMEOUT_SECONDS;
-   int sock = -1;
-   while (tv.tv_sec < t) {
-      ret = socket(PF_INET, SOCK_STREAM, 0);
-      if (ret <= 0) return LUA_HANDLE_ERROR(L, errno);
-      sock = ret;
-      configure_socket(ret);
-      ret = connect(sock, &addr, addrlen);
-      if (!ret) break;
+   int family = addr.ss_family;
+   int sock;
+   ret = connect_socket(&addr, addrlen, &sock);
+   if (ret) return LUA_HANDLE_ERROR(L, ret);
+   struct sockaddr_storage bind_addr;
+   socklen_t bind_addrlen = sizeof(bind_addr);
+   ret = getsockname(sock, (struct sockaddr *)&bind_addr, &bind_addrlen);
+   if (ret) {
       close(sock);
-      sleep(1);
-      gettimeofday(&tv, NULL);
+      return LUA_HANDLE_ERROR(L, errno);
    }
+   uint32_t features;
+   uint32_t version;
+   ret = exchange_handshake(sock, family, &features, &version);
    if (ret) {
       close(sock);
-      return LUA_HANDLE_ERROR(L, errno);
+      return (ret == -1) ? LUA_HANDLE_ERROR(L, errno) : LUA_HANDLE_ERROR_STR(L, handshake_error(ret));
    }
-   addrlen = sizeof(struct sockaddr);
-   struct sockaddr bind_addr;
-   ret = getsockname(sock, &bind_addr, &addrlen);
+   ret = send_stream_hello(sock, num_streams, 0, 0);
    if (ret) {
+      close(sock);
+      return LUA_HANDLE_ERROR(L, ret);
+   }
+   uint64_t group;
+   ret = recv(sock, &group, sizeof(group), MSG_WAITALL);
+   if (ret != sizeof(group)) {
       close(sock);
       return LUA_HANDLE_ERROR(L, errno);
    }
-   int use_fastpath = can_use_fastpath(L, sock, ((struct sockaddr_in *)&bind_addr)->sin_addr.s_addr, ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
+   int use_fastpath = 0;
+   if (features & FEATURE_CUDA_IPC) {
+      use_fastpath = can_use_fastpath(sock, sockaddr_host((struct sockaddr *)&bind_addr), sockaddr_host((struct sockaddr *)&addr));
+      if (use_fastpath < 0) {
+         close(sock);
+         return LUA_HANDLE_ERROR(L, errno);
+      }
+   }
    client_t *client = (client_t *)calloc(1, sizeof(client_t));
    client->sock = sock;
    client->send_rb = ringbuffer_create(SEND_RECV_SIZE);
    client->recv_rb = ringbuffer_create(SEND_RECV_SIZE);
    client->ref_count = 1;
    client->copy_context.use_fastpath = use_fastpath;
+   client->copy_context.use_shm = (features & FEATURE_SHM) != 0;
+   client->copy_context.features = features;
+   client->version = version;
+   if (num_streams > 1) {
+      // the extra connections only carry slices of large transfers
+      client->group = group;
+      client->max_streams = num_streams - 1;
+      client->streams = (stream_t *)calloc(client->max_streams, sizeof(stream_t));
+      client->copy_context.streams = client->streams;
+      for (uint32_t i = 1; i < num_streams; i++) {
+         ret = connect_socket(&addr, addrlen, &sock);
+         if (!ret) {
+            uint32_t stream_features;
+            uint32_t stream_version;
+            int hs = exchange_handshake(sock, family, &stream_features, &stream_version);
+            if (hs) {
+               int err = errno ? errno : EIO;
+               close(sock);
+               destroy_client(L, client);
+               return (hs == -1) ? LUA_HANDLE_ERROR(L, err) : LUA_HANDLE_ERROR_STR(L, handshake_error(hs));
+            }
+            ret = send_stream_hello(sock, num_streams, i, group);
+            if (!ret) ret = add_stream(client, sock);
+            if (ret) close(sock);
+         }
+         if (ret) {
+            destroy_client(L, client);
+            return LUA_HANDLE_ERROR(L, ret);
+         }
+      }
+   }
    client_t **clientp = (client_t **)lua_newuserdata(L, sizeof(client_t *));
    *clientp = client;
    luaL_getmetatable(L, "ipc.client");
@@ -418,34 +1192,39 @@ int cliser_server_clients(lua_State *L) {
    struct timeval tv;
    gettimeofday(&tv, NULL);
    uint32_t t = tv.tv_sec + DEFAULT_TIMEOUT_SECONDS;
-   while (wait > server->num_clients) {
-      fd_set acceptfds;
-      FD_ZERO(&acceptfds);
-      FD_SET(server->sock, &acceptfds);
-      struct timeval accepttv;
-      accepttv.tv_sec = 30;
-      accepttv.tv_usec = 0;
-      int ret = select(server->sock + 1, &acceptfds, NULL, NULL, &accepttv);
-      if (ret > 0 && FD_ISSET(server->sock, &acceptfds)) {
-         struct sockaddr addr;
-         socklen_t addrlen = sizeof(addr);
-         int ret = accept(server->sock, &addr, &addrlen);
-         if (ret <= 0) return LUA_HANDLE_ERROR(L, errno);
-         int sock = ret;
-         configure_socket(ret);
-         int use_fastpath = can_use_fastpath(L, sock, server->ip_address, ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
-         client_t *client = (client_t *)calloc(1, sizeof(client_t));
-         client->sock = sock;
-         client->send_rb = ringbuffer_create(SEND_RECV_SIZE);
-         client->recv_rb = ringbuffer_create(SEND_RECV_SIZE);
-         client->copy_context.use_fastpath = use_fastpath;
-         insert_client(server, client);
-      }
-      gettimeofday(&tv, NULL);
-      if (tv.tv_sec > t) {
+   if (wait > server->num_clients) {
+      int ret = add_accept_threads(server, wait - server->num_clients);
+      if (ret) return LUA_HANDLE_ERROR(L, ret);
+   }
+   // the accept threads do the handshakes, pick up whoever is ready
+   struct timespec ts;
+   ts.tv_sec = t;
+   ts.tv_nsec = 0;
+   pthread_mutex_lock(&server->accept_mutex);
+   while (wait > server->num_clients + server->num_ready) {
+      if (pthread_cond_timedwait(&server->accept_cond, &server->accept_mutex, &ts) == ETIMEDOUT) {
+         pthread_mutex_unlock(&server->accept_mutex);
          return LUA_HANDLE_ERROR_STR(L, "server timed out waiting for clients to connect");
       }
    }
+   // only take in as many as were asked for, the rest wait for a later call
+   client_t *ready = NULL;
+   uint32_t num_clients = server->num_clients;
+   while (wait > num_clients && server->ready) {
+      client_t *client = server->ready;
+      server->ready = client->next;
+      server->num_ready--;
+      client->next = ready;
+      ready = client;
+      num_clients++;
+   }
+   pthread_mutex_unlock(&server->accept_mutex);
+   while (ready) {
+      client_t *next = ready->next;
+      ready->next = NULL;
+      insert_client(server, ready);
+      ready = next;
+   }
    client_t **clients = alloca(server->num_clients * sizeof(client_t*));
    client_t *client = server->clients;
    uint32_t i = 0;
@@ -510,6 +1289,7 @@ int cliser_server_client_close(lua_State *L) {
    server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
    if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
    remove_client(server_client->server, server_client->client);
+   release_shm_segments(&server_client->server->copy_context, server_client->client->sock);
    destroy_client(L, server_client->client);
    server_client->server = NULL;
    server_client->client = NULL;
@@ -517,9 +1297,12 @@ int cliser_server_client_close(lua_State *L) {
 }
 
 char* sock_address(int sock) {
-   socklen_t len = sizeof(struct sockaddr_in);
-   struct sockaddr_in addr;
+   struct sockaddr_storage addr;
+   socklen_t len = sizeof(addr);
    getpeername(sock, (struct sockaddr*)&addr, &len);
+   if (addr.ss_family != AF_INET) {
+      return "unix";
+   }
    char *ip = inet_ntoa(((struct sockaddr_in*)&addr)->sin_addr);
    return ip;
 }
@@ -530,12 +1313,39 @@ int cliser_server_client_address(lua_State *L) {
    return 1;
 }
 
+static int push_features(lua_State *L, client_t *client) {
+   uint32_t features = client->copy_context.features;
+   lua_newtable(L);
+   lua_pushinteger(L, client->version);
+   lua_setfield(L, -2, "version");
+   lua_pushboolean(L, (features & FEATURE_SHM) != 0);
+   lua_setfield(L, -2, "shm");
+   lua_pushboolean(L, (features & FEATURE_CUDA_IPC) != 0);
+   lua_setfield(L, -2, "cudaIPC");
+   lua_pushboolean(L, (features & FEATURE_WIRE) != 0);
+   lua_setfield(L, -2, "wire");
+   lua_pushboolean(L, (features & FEATURE_SPARSE) != 0);
+   lua_setfield(L, -2, "sparse");
+   return 1;
+}
+
+int cliser_server_client_features(lua_State *L) {
+   server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
+   if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
+   return push_features(L, server_client->client);
+}
+
+int cliser_client_features(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   return push_features(L, client);
+}
+
 static size_t sock_send(int sock, void *ptr, size_t len, copy_context_t *copy_context) {
    size_t rem = len;
    while (rem > 0) {
-      double t0 = cliser_profile_seconds();
+      double t0 = syscall_seconds();
       ssize_t ret = send(sock, ptr, rem, 0);
-      copy_context->tx.system_seconds += (cliser_profile_seconds() - t0);
+      copy_context->tx.system_seconds += syscall_elapsed(t0);
       copy_context->tx.num_system_calls++;
       if (ret < 0) {
          return 0;
@@ -550,11 +1360,11 @@ static size_t sock_send(int sock, void *ptr, size_t len, copy_context_t *copy_co
 static size_t sock_recv(int sock, void *ptr, size_t len, copy_context_t *copy_context) {
    size_t rem = len;
    while (rem > 0) {
-      double t0 = cliser_profile_seconds();
+      double t0 = syscall_seconds();
       ssize_t ret = recv(sock, ptr, rem, 0);
-      copy_context->rx.system_seconds += (cliser_profile_seconds() - t0);
+      copy_context->rx.system_seconds += syscall_elapsed(t0);
       copy_context->rx.num_system_calls++;
-      if (ret < 0) {
+      if (ret <= 0) {
          return 0;
       }
       rem -= (size_t)ret;
@@ -564,7 +1374,542 @@ static size_t sock_recv(int sock, void *ptr, size_t len, copy_context_t *copy_co
    return len;
 }
 
-static int sock_send_raw(lua_State *L, int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+static void *stream_thread(void *arg) {
+   stream_t *stream = (stream_t *)arg;
+   pthread_mutex_lock(&stream->mutex);
+   while (1) {
+      while (!stream->busy && stream->running) {
+         pthread_cond_wait(&stream->cond, &stream->mutex);
+      }
+      if (!stream->busy) break;
+      pthread_mutex_unlock(&stream->mutex);
+      size_t ret;
+      if (stream->is_send) {
+         ret = sock_send(stream->sock, stream->ptr, stream->len, &stream->copy_context);
+      } else {
+         ret = sock_recv(stream->sock, stream->ptr, stream->len, &stream->copy_context);
+      }
+      pthread_mutex_lock(&stream->mutex);
+      stream->result = ret;
+      stream->busy = 0;
+      pthread_cond_broadcast(&stream->cond);
+   }
+   pthread_mutex_unlock(&stream->mutex);
+   return NULL;
+}
+
+// a stream only counts once its thread is running, the caller keeps the sock on failure
+static int add_stream(client_t *client, int sock) {
+   stream_t *stream = &client->streams[client->copy_context.num_streams];
+   memset(stream, 0, sizeof(stream_t));
+   stream->sock = sock;
+   stream->running = 1;
+   pthread_mutex_init(&stream->mutex, NULL);
+   pthread_cond_init(&stream->cond, NULL);
+   int ret = pthread_create(&stream->thread, NULL, stream_thread, stream);
+   if (ret) {
+      pthread_mutex_destroy(&stream->mutex);
+      pthread_cond_destroy(&stream->cond);
+      return ret;
+   }
+   client->copy_context.num_streams++;
+   return 0;
+}
+
+static void destroy_streams(client_t *client) {
+   for (uint32_t i = 0; i < client->copy_context.num_streams; i++) {
+      stream_t *stream = &client->streams[i];
+      pthread_mutex_lock(&stream->mutex);
+      stream->running = 0;
+      pthread_cond_broadcast(&stream->cond);
+      pthread_mutex_unlock(&stream->mutex);
+      pthread_join(stream->thread, NULL);
+      pthread_mutex_destroy(&stream->mutex);
+      pthread_cond_destroy(&stream->cond);
+      close(stream->sock);
+   }
+   free(client->streams);
+   client->streams = NULL;
+   client->copy_context.streams = NULL;
+   client->copy_context.num_streams = 0;
+}
+
+static void merge_net_stats(net_stats_t *dst, net_stats_t *src) {
+   dst->num_bytes += src->num_bytes;
+   dst->num_system_calls += src->num_system_calls;
+   dst->system_seconds += src->system_seconds;
+   memset(src, 0, sizeof(net_stats_t));
+}
+
+static int use_streams(copy_context_t *copy_context, size_t len) {
+   return copy_context->num_streams > 0 && len >= STREAM_MIN_BYTES;
+}
+
+// splits a large region evenly over every connection of the client, the first
+// slice goes over the main socket on this thread, the rest on the stream threads
+static size_t sock_stripe(int sock, void *ptr, size_t len, int is_send, copy_context_t *copy_context) {
+   uint32_t num_streams = copy_context->num_streams;
+   size_t part = (len / (num_streams + 1)) & ~(size_t)4095;
+   for (uint32_t i = 0; i < num_streams; i++) {
+      stream_t *stream = &copy_context->streams[i];
+      size_t offset = (i + 1) * part;
+      pthread_mutex_lock(&stream->mutex);
+      stream->is_send = is_send;
+      stream->ptr = ((uint8_t *)ptr) + offset;
+      stream->len = (i + 1 == num_streams) ? len - offset : part;
+      stream->busy = 1;
+      pthread_cond_broadcast(&stream->cond);
+      pthread_mutex_unlock(&stream->mutex);
+   }
+   size_t total = is_send ? sock_send(sock, ptr, part, copy_context) : sock_recv(sock, ptr, part, copy_context);
+   for (uint32_t i = 0; i < num_streams; i++) {
+      stream_t *stream = &copy_context->streams[i];
+      pthread_mutex_lock(&stream->mutex);
+      while (stream->busy) {
+         pthread_cond_wait(&stream->cond, &stream->mutex);
+      }
+      total += stream->result;
+      pthread_mutex_unlock(&stream->mutex);
+      merge_net_stats(&copy_context->tx, &stream->copy_context.tx);
+      merge_net_stats(&copy_context->rx, &stream->copy_context.rx);
+   }
+   return total;
+}
+
+static int use_zerocopy(copy_context_t *copy_context, size_t len) {
+#ifdef CLISER_HAS_ZEROCOPY
+   return copy_context->can_zerocopy && copy_context->zerocopy_threshold && len >= copy_context->zerocopy_threshold;
+#else
+   (void)copy_context;
+   (void)len;
+   return 0;
+#endif
+}
+
+#ifdef CLISER_HAS_ZEROCOPY
+// wait for (at least) the next batch of MSG_ZEROCOPY completions off the socket error queue
+static int zerocopy_reap(int sock, uint32_t *completed, copy_context_t *copy_context) {
+   while (1) {
+      char control[128];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      ssize_t ret = recvmsg(sock, &msg, MSG_ERRQUEUE);
+      if (ret < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd pfd;
+            pfd.fd = sock;
+            pfd.events = 0;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+            continue;
+         }
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+         if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+               (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) continue;
+         struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+         if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+         if (serr->ee_errno != 0) return -1;
+         uint32_t n = serr->ee_data - serr->ee_info + 1;
+         *completed += n;
+         if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+            copy_context->tx.zerocopy_copied += n;
+         }
+      }
+      return 0;
+   }
+}
+#endif
+
+// send without copying into the socket buffer, ptr stays pinned until the kernel is done with it
+static size_t sock_send_zerocopy(int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+#ifdef CLISER_HAS_ZEROCOPY
+   uint32_t issued = 0;
+   uint32_t completed = 0;
+   size_t rem = len;
+   while (rem > 0) {
+      double t0 = syscall_seconds();
+      ssize_t ret = send(sock, ptr, rem, MSG_ZEROCOPY);
+      copy_context->tx.system_seconds += syscall_elapsed(t0);
+      copy_context->tx.num_system_calls++;
+      if (ret < 0) {
+         if (errno == ENOBUFS && completed < issued) {
+            // out of pinned memory budget, wait for earlier sends to complete
+            if (zerocopy_reap(sock, &completed, copy_context)) return 0;
+            continue;
+         }
+         if (errno == ENOBUFS) {
+            if (sock_send(sock, ptr, rem, copy_context) != rem) return 0;
+            break;
+         }
+         return 0;
+      }
+      issued++;
+      rem -= (size_t)ret;
+      copy_context->tx.num_bytes += ret;
+      copy_context->tx.zerocopy_bytes += ret;
+      ptr = ((uint8_t *)ptr) + ret;
+   }
+   while (completed < issued) {
+      if (zerocopy_reap(sock, &completed, copy_context)) return 0;
+   }
+   return len;
+#else
+   return sock_send(sock, ptr, len, copy_context);
+#endif
+}
+
+static int use_shm(copy_context_t *copy_context, size_t len) {
+   return copy_context->use_shm && len >= SHM_MIN_BYTES;
+}
+
+static shm_segment_t *find_shm_segment(copy_context_t *copy_context, int sock, int is_send) {
+   for (size_t i = 0; i < copy_context->num_shm_segments; i++) {
+      shm_segment_t *segment = &copy_context->shm_segments[i];
+      if (segment->sock == sock && segment->is_send == is_send) {
+         return segment;
+      }
+   }
+   return NULL;
+}
+
+static shm_segment_t *map_shm_segment(copy_context_t *copy_context, int sock, int is_send, int fd, size_t size) {
+   void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (ptr == MAP_FAILED) return NULL;
+   shm_segment_t *segment = find_shm_segment(copy_context, sock, is_send);
+   if (segment) {
+      munmap(segment->ptr, segment->size);
+   } else {
+      copy_context->shm_segments = realloc(copy_context->shm_segments, (copy_context->num_shm_segments + 1) * sizeof(shm_segment_t));
+      segment = &copy_context->shm_segments[copy_context->num_shm_segments];
+      copy_context->num_shm_segments++;
+      segment->sock = sock;
+      segment->is_send = is_send;
+   }
+   segment->ptr = ptr;
+   segment->size = size;
+   return segment;
+}
+
+// same host peers share a memfd segment per direction, a transfer is one memcpy
+// on each side and a tiny notification through the socket
+static size_t shm_send(int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+#ifdef CLISER_HAS_SHM
+   double t0 = syscall_seconds();
+   shm_segment_t *segment = find_shm_segment(copy_context, sock, 1);
+   int fd = -1;
+   if (!segment || segment->size < len) {
+      size_t size = ((len + SHM_ROUND_BYTES - 1) / SHM_ROUND_BYTES) * SHM_ROUND_BYTES;
+      fd = memfd_create("torch-ipc", MFD_CLOEXEC);
+      if (fd < 0) return 0;
+      if (ftruncate(fd, size) || !(segment = map_shm_segment(copy_context, sock, 1, fd, size))) {
+         close(fd);
+         return 0;
+      }
+   }
+   memcpy(segment->ptr, ptr, len);
+   uint64_t header[2];
+   header[0] = len;
+   header[1] = segment->size;
+   struct iovec iov;
+   iov.iov_base = header;
+   iov.iov_len = sizeof(header);
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   char control[CMSG_SPACE(sizeof(int))];
+   if (fd >= 0) {
+      // a new segment, hand the peer the descriptor so it can map it too
+      memset(control, 0, sizeof(control));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+   }
+   ssize_t ret = sendmsg(sock, &msg, 0);
+   copy_context->tx.num_system_calls++;
+   if (fd >= 0) close(fd);
+   if (ret != sizeof(header)) return 0;
+   // the segment is free to reuse once the peer has copied out of it,
+   // a zero ack means the peer turned the transfer down
+   uint8_t ack;
+   if (sock_recv(sock, &ack, sizeof(ack), copy_context) != sizeof(ack) || ack != 1) return 0;
+   copy_context->tx.shm_seconds += syscall_elapsed(t0);
+   copy_context->tx.shm_bytes += len;
+   return len;
+#else
+   return sock_send(sock, ptr, len, copy_context);
+#endif
+}
+
+static size_t shm_recv_reduce(int sock, void *ptr, size_t len, size_t element_size, reduce_fn_t reduce, copy_context_t *copy_context) {
+#ifdef CLISER_HAS_SHM
+   double t0 = syscall_seconds();
+   uint64_t header[2];
+   struct iovec iov;
+   iov.iov_base = header;
+   iov.iov_len = sizeof(header);
+   char control[CMSG_SPACE(sizeof(int))];
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+   ssize_t ret = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+   copy_context->rx.num_system_calls++;
+   if (ret != sizeof(header)) return 0;
+   shm_segment_t *segment = find_shm_segment(copy_context, sock, 0);
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+   if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+      segment = map_shm_segment(copy_context, sock, 0, fd, header[1]);
+      close(fd);
+   }
+   // always ack, the sender is parked until it hears back either way
+   uint8_t ack = segment && header[0] == len && segment->size >= len;
+   if (ack) {
+      if (reduce) {
+         reduce(ptr, segment->ptr, len / element_size);
+      } else {
+         memcpy(ptr, segment->ptr, len);
+      }
+   }
+   if (sock_send(sock, &ack, sizeof(ack), copy_context) != sizeof(ack) || !ack) return 0;
+   copy_context->rx.shm_seconds += syscall_elapsed(t0);
+   copy_context->rx.shm_bytes += len;
+   return len;
+#else
+   (void)element_size;
+   (void)reduce;
+   return sock_recv(sock, ptr, len, copy_context);
+#endif
+}
+
+static size_t shm_recv(int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+   return shm_recv_reduce(sock, ptr, len, 1, NULL, copy_context);
+}
+
+// a receiver that gives up on a transfer after its header still has to turn
+// away a shared memory payload of len bytes, or the sender waits for it forever
+static void shm_reject(int sock, size_t len, copy_context_t *copy_context) {
+#ifdef CLISER_HAS_SHM
+   if (use_shm(copy_context, len)) {
+      shm_recv(sock, NULL, 0, copy_context);
+   }
+#else
+   (void)sock;
+   (void)len;
+   (void)copy_context;
+#endif
+}
+
+// fp16/bf16 wire encodings, round to nearest even on the way out
+static uint16_t float_to_half(float f) {
+   uint32_t x;
+   memcpy(&x, &f, sizeof(x));
+   uint32_t sign = (x >> 16) & 0x8000;
+   x &= 0x7FFFFFFF;
+   if (x >= 0x47800000) {
+      return sign | ((x > 0x7F800000) ? 0x7E00 : 0x7C00);
+   }
+   if (x < 0x38800000) {
+      memcpy(&f, &x, sizeof(f));
+      f += 0.5f;
+      memcpy(&x, &f, sizeof(x));
+      return sign | (uint16_t)(x - 0x3F000000);
+   }
+   x += 0xC8000FFF + ((x >> 13) & 1);
+   return sign | (uint16_t)(x >> 13);
+}
+
+static float half_to_float(uint16_t h) {
+   uint32_t x = (uint32_t)(h & 0x7FFF) << 13;
+   uint32_t exp = x & 0x0F800000;
+   x += 0x38000000;
+   if (exp == 0x0F800000) {
+      x += 0x38000000;
+   } else if (exp == 0) {
+      float f;
+      float magic = 6.103515625e-05f;
+      x += 0x00800000;
+      memcpy(&f, &x, sizeof(f));
+      f -= magic;
+      memcpy(&x, &f, sizeof(x));
+   }
+   x |= (uint32_t)(h & 0x8000) << 16;
+   float f;
+   memcpy(&f, &x, sizeof(f));
+   return f;
+}
+
+static uint16_t float_to_bfloat(float f) {
+   uint32_t x;
+   memcpy(&x, &f, sizeof(x));
+   if ((x & 0x7FFFFFFF) > 0x7F800000) {
+      return (x >> 16) | 0x40;
+   }
+   x += 0x7FFF + ((x >> 16) & 1);
+   return x >> 16;
+}
+
+static float bfloat_to_float(uint16_t h) {
+   uint32_t x = (uint32_t)h << 16;
+   float f;
+   memcpy(&f, &x, sizeof(f));
+   return f;
+}
+
+#ifdef CLISER_HAS_F16C
+static int has_f16c() {
+   static int f16c = -1;
+   if (f16c < 0) {
+      unsigned int eax, ebx, ecx, edx;
+      f16c = __builtin_cpu_supports("avx") && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+   }
+   return f16c;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t float_to_half_f16c(uint16_t *dst, const float *src, size_t count) {
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8) {
+      _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+   }
+   return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t half_to_float_f16c(float *dst, const uint16_t *src, size_t count) {
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8) {
+      _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+   }
+   return i;
+}
+#endif
+
+static void wire_encode_float(int wire_format, uint16_t *dst, const float *src, size_t count) {
+   size_t i = 0;
+   if (wire_format == WIRE_FORMAT_FP16) {
+#ifdef CLISER_HAS_F16C
+      if (has_f16c()) {
+         i = float_to_half_f16c(dst, src, count);
+      }
+#endif
+      for (; i < count; i++) {
+         dst[i] = float_to_half(src[i]);
+      }
+   } else {
+      for (; i < count; i++) {
+         dst[i] = float_to_bfloat(src[i]);
+      }
+   }
+}
+
+static void wire_decode_float(int wire_format, float *dst, const uint16_t *src, size_t count) {
+   size_t i = 0;
+   if (wire_format == WIRE_FORMAT_FP16) {
+#ifdef CLISER_HAS_F16C
+      if (has_f16c()) {
+         i = half_to_float_f16c(dst, src, count);
+      }
+#endif
+      for (; i < count; i++) {
+         dst[i] = half_to_float(src[i]);
+      }
+   } else {
+      for (; i < count; i++) {
+         dst[i] = bfloat_to_float(src[i]);
+      }
+   }
+}
+
+// chunked transfers stage through memory kept on the copy context, these run on
+// the async, stream and accept threads too, which have default size stacks
+static void *get_staging(copy_context_t *copy_context) {
+   if (!copy_context->staging) {
+      copy_context->staging = malloc(STAGING_BYTES);
+   }
+   return copy_context->staging;
+}
+
+// converts and sends a chunk at a time so the encoded data is still in cache
+// when it is handed to the socket, doubles are narrowed to float first
+static size_t sock_send_wire(int sock, const void *ptr, size_t count, size_t element_size, int wire_format, copy_context_t *copy_context) {
+   uint16_t *wire = (uint16_t *)get_staging(copy_context);
+   if (!wire) return 0;
+   float *narrow = (float *)(wire + WIRE_CHUNK_COUNT);
+   size_t sent = 0;
+   while (sent < count) {
+      size_t cb = (count - sent > WIRE_CHUNK_COUNT) ? WIRE_CHUNK_COUNT : count - sent;
+      const float *src;
+      if (element_size == sizeof(double)) {
+         const double *d = (const double *)ptr + sent;
+         for (size_t i = 0; i < cb; i++) {
+            narrow[i] = (float)d[i];
+         }
+         src = narrow;
+      } else {
+         src = (const float *)ptr + sent;
+      }
+      wire_encode_float(wire_format, wire, src, cb);
+      if (sock_send(sock, wire, cb * sizeof(uint16_t), copy_context) != cb * sizeof(uint16_t)) break;
+      sent += cb;
+   }
+   return sent;
+}
+
+// with a reduce the decoded chunk is folded into ptr rather than stored
+static size_t sock_recv_wire_reduce(int sock, void *ptr, size_t count, size_t element_size, int wire_format, reduce_fn_t reduce, copy_context_t *copy_context) {
+   uint16_t *wire = (uint16_t *)get_staging(copy_context);
+   if (!wire) return 0;
+   float *wide = (float *)(wire + WIRE_CHUNK_COUNT);
+   double *staging = (double *)(wide + WIRE_CHUNK_COUNT);
+   size_t recvd = 0;
+   while (recvd < count) {
+      size_t cb = (count - recvd > WIRE_CHUNK_COUNT) ? WIRE_CHUNK_COUNT : count - recvd;
+      if (sock_recv(sock, wire, cb * sizeof(uint16_t), copy_context) != cb * sizeof(uint16_t)) break;
+      if (element_size == sizeof(double)) {
+         wire_decode_float(wire_format, wide, wire, cb);
+         double *d = reduce ? staging : (double *)ptr + recvd;
+         for (size_t i = 0; i < cb; i++) {
+            d[i] = wide[i];
+         }
+         if (reduce) reduce((double *)ptr + recvd, staging, cb);
+      } else if (reduce) {
+         wire_decode_float(wire_format, wide, wire, cb);
+         reduce((float *)ptr + recvd, wide, cb);
+      } else {
+         wire_decode_float(wire_format, (float *)ptr + recvd, wire, cb);
+      }
+      recvd += cb;
+   }
+   return recvd;
+}
+
+static size_t sock_recv_wire(int sock, void *ptr, size_t count, size_t element_size, int wire_format, copy_context_t *copy_context) {
+   return sock_recv_wire_reduce(sock, ptr, count, element_size, wire_format, NULL, copy_context);
+}
+
+static int sock_send_raw(lua_State *L, int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+   if (use_shm(copy_context, len)) {
+      if (shm_send(sock, ptr, len, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes through shared memory");
+      return 0;
+   }
+   if (use_streams(copy_context, len)) {
+      if (sock_stripe(sock, ptr, len, 1, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes across streams");
+      return 0;
+   }
    int ret = sock_send(sock, ptr, len, copy_context);
    if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
    if ((size_t)ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
@@ -572,70 +1917,428 @@ static int sock_send_raw(lua_State *L, int sock, void *ptr, size_t len, copy_con
 }
 
 static int sock_recv_raw(lua_State *L, int sock, void *ptr, size_t len, copy_context_t *copy_context) {
+   if (use_shm(copy_context, len)) {
+      if (shm_recv(sock, ptr, len, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes through shared memory");
+      return 0;
+   }
+   if (use_streams(copy_context, len)) {
+      if (sock_stripe(sock, ptr, len, 0, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes across streams");
+      return 0;
+   }
    int ret = sock_recv(sock, ptr, len, copy_context);
    if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
    if ((size_t)ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
    return 0;
 }
 
-static int sock_send_msg(lua_State *L, int index, int sock, ringbuffer_t *rb, copy_context_t *copy_context) {
-   ringbuffer_push_write_pos(rb);
-   int ret = rb_save(L, index, rb, 1, 0);
-   if (ret) return LUA_HANDLE_ERROR(L, ret);
-   size_t len = ringbuffer_peek(rb);
+// folds the bytes into ptr a chunk at a time as they arrive, no full size temporary
+static int sock_recv_reduce(lua_State *L, int sock, void *ptr, size_t len, size_t element_size, reduce_fn_t reduce, copy_context_t *copy_context) {
+   if (use_shm(copy_context, len)) {
+      if (shm_recv_reduce(sock, ptr, len, element_size, reduce, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes through shared memory");
+      return 0;
+   }
+   if (use_streams(copy_context, len)) {
+      // the slices land in parallel, so striping needs the whole region staged
+      void *staging = malloc(len);
+      if (!staging) return LUA_HANDLE_ERROR(L, ENOMEM);
+      size_t ret = sock_stripe(sock, staging, len, 0, copy_context);
+      if (ret == len) reduce(ptr, staging, len / element_size);
+      free(staging);
+      if (ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes across streams");
+      return 0;
+   }
+   void *staging = get_staging(copy_context);
+   if (!staging) return LUA_HANDLE_ERROR(L, ENOMEM);
+   size_t chunk = REDUCE_CHUNK_BYTES - (REDUCE_CHUNK_BYTES % element_size);
+   for (size_t off = 0; off < len; off += chunk) {
+      size_t cb = (len - off > chunk) ? chunk : len - off;
+      if (sock_recv(sock, staging, cb, copy_context) != cb) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+      reduce((uint8_t *)ptr + off, staging, cb / element_size);
+   }
+   return 0;
+}
+
+// the gaps between sparse entries are zeros, or zeros folded in when reducing
+static void sparse_fill_gap(uint8_t *dst, size_t len, size_t element_size, reduce_fn_t reduce, int skip_zeros) {
+   static const uint64_t zeros[512];
+   if (!reduce) {
+      memset(dst, 0, len);
+      return;
+   }
+   if (skip_zeros) return;
+   while (len > 0) {
+      size_t cb = (len > sizeof(zeros)) ? sizeof(zeros) : len;
+      reduce(dst, zeros, cb / element_size);
+      dst += cb;
+      len -= cb;
+   }
+}
+
+// chunks of {n, n row indices, n rows of values} ending with n = 0, a row is a single element unless blocked by row
+static size_t sock_recv_sparse(int sock, void *ptr, size_t count, size_t element_size, size_t row_len, reduce_fn_t reduce, int skip_zeros, copy_context_t *copy_context) {
+   uint8_t *staging = (uint8_t *)get_staging(copy_context);
+   if (!staging) return 0;
+   uint8_t *dst = (uint8_t *)ptr;
+   size_t row_bytes = row_len * element_size;
+   size_t rows = count / row_len;
+   size_t next = 0;
+   while (1) {
+      uint32_t n;
+      if (sock_recv(sock, &n, sizeof(n), copy_context) != sizeof(n)) return 0;
+      if (n == 0) break;
+      size_t len = SPARSE_INDEX_BYTES(n) + (n * row_bytes);
+      if (len > SPARSE_BLOCK_BYTES) return 0;
+      if (sock_recv(sock, staging, len, copy_context) != len) return 0;
+      uint32_t *index = (uint32_t *)staging;
+      uint8_t *values = (uint8_t *)staging + SPARSE_INDEX_BYTES(n);
+      for (uint32_t i = 0; i < n; i++) {
+         if (index[i] < next || index[i] >= rows) return 0;
+         sparse_fill_gap(dst + (next * row_bytes), (index[i] - next) * row_bytes, element_size, reduce, skip_zeros);
+         if (reduce) {
+            reduce(dst + (index[i] * row_bytes), values + (i * row_bytes), row_len);
+         } else {
+            memcpy(dst + (index[i] * row_bytes), values + (i * row_bytes), row_bytes);
+         }
+         next = index[i] + 1;
+      }
+   }
+   sparse_fill_gap(dst + (next * row_bytes), (rows - next) * row_bytes, element_size, reduce, skip_zeros);
+   return count;
+}
+
+static int iov_advance(struct iovec **iovp, int iovcnt, size_t skip) {
+   struct iovec *iov = *iovp;
+   while (iovcnt > 0 && skip >= iov->iov_len) {
+      skip -= iov->iov_len;
+      iov++;
+      iovcnt--;
+   }
+   if (iovcnt > 0) {
+      iov->iov_base = ((uint8_t *)iov->iov_base) + skip;
+      iov->iov_len -= skip;
+   }
+   *iovp = iov;
+   return iovcnt;
+}
+
+static size_t sock_sendv(int sock, struct iovec *iov, int iovcnt, copy_context_t *copy_context) {
+   size_t len = 0;
+   for (int i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+   }
+   copy_context->tx.num_regions += iovcnt;
+   size_t rem = len;
+   while (rem > 0) {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iovcnt;
+      double t0 = syscall_seconds();
+      ssize_t ret = sendmsg(sock, &msg, 0);
+      copy_context->tx.system_seconds += syscall_elapsed(t0);
+      copy_context->tx.num_system_calls++;
+      if (ret < 0) {
+         return 0;
+      }
+      rem -= (size_t)ret;
+      copy_context->tx.num_bytes += ret;
+      iovcnt = iov_advance(&iov, iovcnt, (size_t)ret);
+   }
+   return len;
+}
+
+static size_t sock_recvv(int sock, struct iovec *iov, int iovcnt, copy_context_t *copy_context) {
+   size_t len = 0;
+   for (int i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+   }
+   copy_context->rx.num_regions += iovcnt;
+   size_t rem = len;
+   while (rem > 0) {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iovcnt;
+      double t0 = syscall_seconds();
+      ssize_t ret = recvmsg(sock, &msg, MSG_WAITALL);
+      copy_context->rx.system_seconds += syscall_elapsed(t0);
+      copy_context->rx.num_system_calls++;
+      if (ret <= 0) {
+         return 0;
+      }
+      rem -= (size_t)ret;
+      copy_context->rx.num_bytes += ret;
+      iovcnt = iov_advance(&iov, iovcnt, (size_t)ret);
+   }
+   return len;
+}
+
+// gathers many small regions (tensor header, non-contiguous rows) into one sendmsg/recvmsg
+typedef struct iov_batch_t {
+   struct iovec iov[CLISER_IOV_MAX];
+   int count;
+   int is_send;
+} iov_batch_t;
+
+static void iov_batch_init(iov_batch_t *batch, int is_send) {
+   batch->count = 0;
+   batch->is_send = is_send;
+}
+
+static int iov_batch_flush(lua_State *L, int sock, iov_batch_t *batch, copy_context_t *copy_context) {
+   if (batch->count == 0) return 0;
+   size_t len = 0;
+   for (int i = 0; i < batch->count; i++) {
+      len += batch->iov[i].iov_len;
+   }
+   size_t ret;
+   if (batch->is_send) {
+      ret = sock_sendv(sock, batch->iov, batch->count, copy_context);
+   } else {
+      ret = sock_recvv(sock, batch->iov, batch->count, copy_context);
+   }
+   batch->count = 0;
+   if (ret != len) {
+      if (batch->is_send) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+      return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+   }
+   return 0;
+}
+
+static int iov_batch_add(lua_State *L, int sock, iov_batch_t *batch, void *ptr, size_t len, copy_context_t *copy_context) {
+   if (len == 0) return 0;
+   if (use_shm(copy_context, len)) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      if (batch->is_send) {
+         if (shm_send(sock, ptr, len, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes through shared memory");
+      } else {
+         if (shm_recv(sock, ptr, len, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes through shared memory");
+      }
+      return 0;
+   }
+   if (use_streams(copy_context, len)) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      if (sock_stripe(sock, ptr, len, batch->is_send, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to transfer the correct number of bytes across streams");
+      return 0;
+   }
+   if (batch->is_send && use_zerocopy(copy_context, len)) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      if (sock_send_zerocopy(sock, ptr, len, copy_context) != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+      return 0;
+   }
+   if (batch->count > 0) {
+      struct iovec *last = &batch->iov[batch->count - 1];
+      if (((uint8_t *)last->iov_base) + last->iov_len == (uint8_t *)ptr) {
+         last->iov_len += len;
+         return 0;
+      }
+   }
+   if (batch->count == CLISER_IOV_MAX) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+   }
+   batch->iov[batch->count].iov_base = ptr;
+   batch->iov[batch->count].iov_len = len;
+   batch->count++;
+   return 0;
+}
+
+// steps to the next row of a tensor in logical order, the last dimension being the row
+static long strided_next_row(long *index, long *size, long *stride, int nDim, long offset) {
+   for (int d = nDim - 2; d >= 0; d--) {
+      index[d]++;
+      offset += stride[d];
+      if (index[d] < size[d]) break;
+      offset -= index[d] * stride[d];
+      index[d] = 0;
+   }
+   return offset;
+}
+
+static int sock_pack_msg(lua_State *L, int index, ringbuffer_t *rb, size_t *len) {
+   int ret;
+   while (1) {
+      ringbuffer_push_write_pos(rb);
+      ret = rb_save(L, index, rb, 1, 0);
+      if (ret != -ENOMEM) break;
+      // the message does not fit, double the buffer and serialize again
+      ringbuffer_pop_write_pos(rb);
+      if (rb->cb >= MAX_MSG_SIZE) return LUA_HANDLE_ERROR_STR(L, "message is too large to send");
+      if (ringbuffer_grow_by(rb, rb->cb)) return LUA_HANDLE_ERROR(L, ENOMEM);
+   }
+   *len = ringbuffer_peek(rb);
    ringbuffer_pop_write_pos(rb);
-   if (ret) return ret;
-   ret = sock_send(sock, &len, sizeof(len), copy_context);
-   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
-   if (ret != sizeof(len)) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
-   ret = sock_send(sock, ringbuffer_buf_ptr(rb), len, copy_context);
-   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
-   if ((size_t)ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+   if (ret) return LUA_HANDLE_ERROR(L, ret);
    return 0;
 }
 
-static int sock_recv_msg(lua_State *L, int sock, ringbuffer_t *rb, copy_context_t *copy_context) {
+static int sock_send_msg(lua_State *L, int index, int sock, ringbuffer_t *rb, copy_context_t *copy_context) {
    size_t len;
-   int ret = sock_recv(sock, &len, sizeof(len), copy_context);
+   int ret = sock_pack_msg(L, index, rb, &len);
+   if (ret) return ret;
+   struct iovec iov[2];
+   iov[0].iov_base = &len;
+   iov[0].iov_len = sizeof(len);
+   iov[1].iov_base = ringbuffer_buf_ptr(rb);
+   iov[1].iov_len = len;
+   if (sock_sendv(sock, iov, 2, copy_context) != sizeof(len) + len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+   return 0;
+}
+
+// appends a framed message behind the ones already corked in rb
+static int sock_cork_msg(lua_State *L, int index, ringbuffer_t *rb) {
+   size_t start = ringbuffer_peek(rb);
+   size_t len = LEN_INVALID;
+   int ret;
+   while (1) {
+      ringbuffer_push_write_pos(rb);
+      ret = -ENOMEM;
+      if (ringbuffer_write(rb, &len, sizeof(len)) == sizeof(len)) {
+         ret = rb_save(L, index, rb, 1, 0);
+      }
+      if (ret != -ENOMEM) break;
+      ringbuffer_pop_write_pos(rb);
+      if (rb->cb >= MAX_MSG_SIZE) return LUA_HANDLE_ERROR_STR(L, "message is too large to send");
+      if (ringbuffer_grow_by(rb, rb->cb)) return LUA_HANDLE_ERROR(L, ENOMEM);
+   }
+   if (ret) {
+      ringbuffer_pop_write_pos(rb);
+      return LUA_HANDLE_ERROR(L, ret);
+   }
+   len = ringbuffer_peek(rb) - start - sizeof(len);
+   memcpy((uint8_t *)ringbuffer_buf_ptr(rb) + start, &len, sizeof(len));
+   return 0;
+}
+
+// corked messages go out in one write, ahead of anything else on the socket
+static int flush_client(lua_State *L, client_t *client, copy_context_t *copy_context) {
+   ringbuffer_t *rb = client->send_rb;
+   size_t len = ringbuffer_peek(rb);
+   if (len == 0) return 0;
+   size_t ret = sock_send(client->sock, ringbuffer_buf_ptr(rb), len, copy_context);
+   ringbuffer_reset(rb);
+   if (ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+   return 0;
+}
+
+static int flush_server_clients(lua_State *L, server_t *server) {
+   client_t *client = server->clients;
+   while (client) {
+      int ret = flush_client(L, client, &server->copy_context);
+      if (ret) return ret;
+      client = client->next;
+   }
+   return 0;
+}
+
+static int client_send_msg(lua_State *L, int index, client_t *client, copy_context_t *copy_context) {
+   if (!client->corked) return sock_send_msg(L, index, client->sock, client->send_rb, copy_context);
+   int ret = sock_cork_msg(L, index, client->send_rb);
+   if (ret) return ret;
+   if (ringbuffer_peek(client->send_rb) < CORK_MAX_BYTES) return 0;
+   return flush_client(L, client, copy_context);
+}
+
+// the length comes from the peer, do not let it ask for anything we would not send
+static int sock_check_msg_len(lua_State *L, size_t len, ringbuffer_t *rb) {
    if (len == LEN_INVALID) {
       return LUA_HANDLE_ERROR_STR(L, "remote peer disconnected\n");
    }
-   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
-   if (ret != sizeof(len)) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
-   if (len > SEND_RECV_SIZE) return LUA_HANDLE_ERROR_STR(L, "message size is too large");
-   ret = sock_recv(sock, ringbuffer_buf_ptr(rb), len, copy_context);
-   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
-   if ((size_t)ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+   if (len > MAX_MSG_SIZE) return LUA_HANDLE_ERROR_STR(L, "remote peer sent a message that is too large");
+   if (len > rb->cb && ringbuffer_grow_by(rb, len - rb->cb)) return LUA_HANDLE_ERROR(L, ENOMEM);
+   return 0;
+}
+
+static int sock_load_msg(lua_State *L, ringbuffer_t *rb, size_t len) {
    ringbuffer_reset_read_pos(rb);
    ringbuffer_push_write_pos(rb);
-   if (ringbuffer_write(rb, NULL, ret) != (size_t)ret) {
+   if (ringbuffer_write(rb, NULL, len) != len) {
       ringbuffer_pop_write_pos(rb);
       return LUA_HANDLE_ERROR_STR(L, "failed to write the correct number of bytes into the ringbuffer");
    }
-   ret = rb_load(L, rb);
-   if (ret < 0) return LUA_HANDLE_ERROR(L, ret);
-   return ret;
+   int n = rb_load(L, rb);
+   if (n < 0) return LUA_HANDLE_ERROR(L, n);
+   return n;
 }
 
-static int sock_recv_msg_peek(lua_State *L, int sock, ringbuffer_t *rb) {
+static int sock_recv_msg(lua_State *L, int sock, ringbuffer_t *rb, copy_context_t *copy_context) {
    size_t len;
-   int ret = recv(sock, &len, sizeof(len), MSG_PEEK | MSG_DONTWAIT);
-   if (ret < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
-      return LUA_HANDLE_ERROR(L, errno);
+   size_t ret = sock_recv(sock, &len, sizeof(len), copy_context);
+   if (ret != sizeof(len)) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+   sock_check_msg_len(L, len, rb);
+   ret = sock_recv(sock, ringbuffer_buf_ptr(rb), len, copy_context);
+   if (ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+   return sock_load_msg(L, rb, len);
+}
+
+// reads whatever has arrived of the client's next message without blocking, 1 once it is
+// whole, so recvAny and recvAll never sit on one slow sender while others have messages waiting
+static int sock_recv_msg_partial(lua_State *L, client_t *client, copy_context_t *copy_context) {
+   while (1) {
+      uint8_t *ptr;
+      size_t rem;
+      if (client->msg_got < sizeof(client->msg_len)) {
+         ptr = (uint8_t *)&client->msg_len + client->msg_got;
+         rem = sizeof(client->msg_len) - client->msg_got;
+      } else {
+         size_t got = client->msg_got - sizeof(client->msg_len);
+         if (got == client->msg_len) return 1;
+         ptr = (uint8_t *)ringbuffer_buf_ptr(client->recv_rb) + got;
+         rem = client->msg_len - got;
+      }
+      double t0 = syscall_seconds();
+      ssize_t ret = recv(client->sock, ptr, rem, MSG_DONTWAIT);
+      copy_context->rx.system_seconds += syscall_elapsed(t0);
+      copy_context->rx.num_system_calls++;
+      if (ret < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+         if (errno == EINTR) continue;
+         return LUA_HANDLE_ERROR(L, errno);
+      }
+      if (ret == 0) return LUA_HANDLE_ERROR_STR(L, "remote peer disconnected\n");
+      copy_context->rx.num_bytes += ret;
+      client->msg_got += ret;
+      if (client->msg_got == sizeof(client->msg_len)) {
+         sock_check_msg_len(L, client->msg_len, client->recv_rb);
+      }
    }
-   if (ret != sizeof(len)) return 0;
-   if (len > SEND_RECV_SIZE) return LUA_HANDLE_ERROR_STR(L, "message size is too large");
-   ret = recv(sock, ringbuffer_buf_ptr(rb), len, MSG_PEEK | MSG_DONTWAIT);
-   if (ret < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
-      return LUA_HANDLE_ERROR(L, errno);
+}
+
+static int client_load_msg(lua_State *L, client_t *client) {
+   client->msg_got = 0;
+   return sock_load_msg(L, client->recv_rb, client->msg_len);
+}
+
+// a plain recv first finishes whatever message recvAny, recvAll or recvAsync left half read
+static int client_recv_msg(lua_State *L, client_t *client, copy_context_t *copy_context) {
+   if (!client->msg_got) return sock_recv_msg(L, client->sock, client->recv_rb, copy_context);
+   while (!sock_recv_msg_partial(L, client, copy_context)) {
+      struct pollfd fd;
+      fd.fd = client->sock;
+      fd.events = POLLIN;
+      fd.revents = 0;
+      if (poll(&fd, 1, -1) < 0 && errno != EINTR) return LUA_HANDLE_ERROR(L, errno);
    }
-   if ((size_t)ret != len) return 0;
-   return ret;
+   return client_load_msg(L, client);
+}
+
+// send(value, offset, count) and recv(value, offset, count) move a slice of a flat value
+static int sock_range_userdata(lua_State *L, int index, const char *name, int sock, copy_context_t *copy_context) {
+   if (!luaL_getmetafield(L, index, name)) return LUA_HANDLE_ERROR_STR(L, "ranged transfers are not supported for this type");
+   lua_pushvalue(L, index);
+   lua_pushinteger(L, sock);
+   lua_pushlightuserdata(L, copy_context);
+   lua_pushvalue(L, index + 1);
+   lua_pushvalue(L, index + 2);
+   lua_call(L, 5, 0);
+   return 0;
 }
 
 static int sock_send_userdata(lua_State *L, int index, int sock, copy_context_t *copy_context) {
+   if (lua_type(L, index + 1) == LUA_TNUMBER) return sock_range_userdata(L, index, "_cliser_write_range", sock, copy_context);
    if (!luaL_getmetafield(L, index, "_cliser_write")) return LUA_HANDLE_ERROR_STR(L, "could not find _cliser_write function in metatable");
    lua_pushvalue(L, index);
    lua_pushinteger(L, sock);
@@ -649,7 +2352,18 @@ static int sock_send_userdata(lua_State *L, int index, int sock, copy_context_t
    return 0;
 }
 
+static int sock_recv_reduce_userdata(lua_State *L, int index, int sock, copy_context_t *copy_context) {
+   if (!luaL_getmetafield(L, index, "_cliser_recv_reduce")) return LUA_HANDLE_ERROR_STR(L, "could not find _cliser_recv_reduce function in metatable");
+   lua_pushvalue(L, index);
+   lua_pushinteger(L, sock);
+   lua_pushlightuserdata(L, copy_context);
+   lua_pushvalue(L, index + 1);
+   lua_call(L, 4, 0);
+   return 0;
+}
+
 static int sock_recv_userdata(lua_State *L, int index, int sock, copy_context_t *copy_context) {
+   if (lua_type(L, index + 1) == LUA_TNUMBER) return sock_range_userdata(L, index, "_cliser_read_range", sock, copy_context);
    if (!luaL_getmetafield(L, index, "_cliser_read")) return LUA_HANDLE_ERROR_STR(L, "could not find _cliser_read function in metatable");
    lua_pushvalue(L, index);
    lua_pushinteger(L, sock);
@@ -663,44 +2377,151 @@ static int sock_recv_userdata(lua_State *L, int index, int sock, copy_context_t
    return 0;
 }
 
+// the server shares one copy context across clients, take on how this client transfers
+static void use_client_copy_mode(server_t *server, client_t *client) {
+   server->copy_context.use_fastpath = client->copy_context.use_fastpath;
+   server->copy_context.use_shm = client->copy_context.use_shm;
+   server->copy_context.streams = client->copy_context.streams;
+   server->copy_context.num_streams = client->copy_context.num_streams;
+   server->copy_context.features = client->copy_context.features;
+   server->copy_context.can_zerocopy = client->copy_context.can_zerocopy;
+}
+
 int cliser_server_send(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
    if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
+   op_timer_t timer;
+   op_timer_start(&timer, &server_client->server->copy_context, OP_SEND);
    int ret;
    if (lua_type(L, 2) == LUA_TUSERDATA) {
-      server_client->server->copy_context.use_fastpath = server_client->client->copy_context.use_fastpath;
-      ret = sock_send_userdata(L, 2, server_client->client->sock, &server_client->server->copy_context);
+      use_client_copy_mode(server_client->server, server_client->client);
+      ret = flush_client(L, server_client->client, &server_client->server->copy_context);
+      if (ret == 0) ret = sock_send_userdata(L, 2, server_client->client->sock, &server_client->server->copy_context);
    } else {
-      ret = sock_send_msg(L, 2, server_client->client->sock, server_client->client->send_rb, &server_client->server->copy_context);
+      ret = client_send_msg(L, 2, server_client->client, &server_client->server->copy_context);
    }
-   server_client->server->copy_context.tx.total_seconds += (cliser_profile_seconds() - t0);
-   server_client->server->copy_context.tx.num_calls++;
+   op_timer_stop(&timer);
    return ret;
 }
 
 int cliser_server_recv(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
    if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
-   int ret;
+   op_timer_t timer;
+   op_timer_start(&timer, &server_client->server->copy_context, OP_RECV);
+   int ret = flush_client(L, server_client->client, &server_client->server->copy_context);
+   if (ret) return ret;
    if (lua_type(L, 2) == LUA_TUSERDATA) {
-      server_client->server->copy_context.use_fastpath = server_client->client->copy_context.use_fastpath;
+      use_client_copy_mode(server_client->server, server_client->client);
       ret = sock_recv_userdata(L, 2, server_client->client->sock, &server_client->server->copy_context);
       if (ret == 0) {
          lua_pushvalue(L, 2);
          ret = 1;
       }
-   } else {
-      ret = sock_recv_msg(L, server_client->client->sock, server_client->client->recv_rb, &server_client->server->copy_context);
+   } else {
+      ret = client_recv_msg(L, server_client->client, &server_client->server->copy_context);
+   }
+   op_timer_stop(&timer);
+   return ret;
+}
+
+int cliser_server_recv_reduce(lua_State *L) {
+   server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
+   if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
+   op_timer_t timer;
+   op_timer_start(&timer, &server_client->server->copy_context, OP_RECV);
+   int ret = flush_client(L, server_client->client, &server_client->server->copy_context);
+   if (ret) return ret;
+   use_client_copy_mode(server_client->server, server_client->client);
+   ret = sock_recv_reduce_userdata(L, 2, server_client->client->sock, &server_client->server->copy_context);
+   if (ret == 0) {
+      lua_pushvalue(L, 2);
+      ret = 1;
+   }
+   op_timer_stop(&timer);
+   return ret;
+}
+
+static async_op_t *create_async_op(int is_send) {
+   async_op_t *op = (async_op_t *)calloc(1, sizeof(async_op_t));
+   pthread_mutex_init(&op->mutex, NULL);
+   pthread_cond_init(&op->done_cond, NULL);
+   op->is_send = is_send;
+   op->ref_count = 1;
+   return op;
+}
+
+static void async_op_release(async_op_t *op) {
+   pthread_mutex_lock(&op->mutex);
+   int ref_count = --op->ref_count;
+   pthread_mutex_unlock(&op->mutex);
+   if (ref_count == 0) {
+      pthread_mutex_destroy(&op->mutex);
+      pthread_cond_destroy(&op->done_cond);
+      free(op->header);
+      free(op);
+   }
+}
+
+typedef struct broadcast_target_t {
+   int sock;
+   struct iovec iov[2];
+   struct iovec *cur;
+   int count;
+} broadcast_target_t;
+
+// writes the same bytes to every target at once, whichever socket has room
+// takes the next piece so no receiver sits idle behind the others
+static int sock_broadcast(lua_State *L, broadcast_target_t *targets, int num_targets, copy_context_t *copy_context) {
+   struct pollfd *fds = alloca(num_targets * sizeof(struct pollfd));
+   int *which = alloca(num_targets * sizeof(int));
+   int remaining = 0;
+   for (int i = 0; i < num_targets; i++) {
+      targets[i].cur = targets[i].iov;
+      copy_context->tx.num_regions += targets[i].count;
+      if (targets[i].count > 0) remaining++;
+   }
+   while (remaining > 0) {
+      int nfds = 0;
+      for (int i = 0; i < num_targets; i++) {
+         if (targets[i].count > 0) {
+            fds[nfds].fd = targets[i].sock;
+            fds[nfds].events = POLLOUT;
+            fds[nfds].revents = 0;
+            which[nfds] = i;
+            nfds++;
+         }
+      }
+      int ret = poll(fds, nfds, -1);
+      if (ret < 0) {
+         if (errno == EINTR) continue;
+         return LUA_HANDLE_ERROR(L, errno);
+      }
+      for (int j = 0; j < nfds; j++) {
+         if (!fds[j].revents) continue;
+         if (fds[j].revents & (POLLERR | POLLHUP | POLLNVAL)) return LUA_HANDLE_ERROR_STR(L, "client disconnected during broadcast");
+         broadcast_target_t *target = &targets[which[j]];
+         struct msghdr msg;
+         memset(&msg, 0, sizeof(msg));
+         msg.msg_iov = target->cur;
+         msg.msg_iovlen = target->count;
+         double t0 = syscall_seconds();
+         ssize_t sent = sendmsg(target->sock, &msg, MSG_DONTWAIT);
+         copy_context->tx.system_seconds += syscall_elapsed(t0);
+         copy_context->tx.num_system_calls++;
+         if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            return LUA_HANDLE_ERROR(L, errno);
+         }
+         copy_context->tx.num_bytes += sent;
+         target->count = iov_advance(&target->cur, target->count, sent);
+         if (target->count == 0) remaining--;
+      }
    }
-   server_client->server->copy_context.rx.total_seconds += (cliser_profile_seconds() - t0);
-   server_client->server->copy_context.rx.num_calls++;
-   return ret;
+   return 0;
 }
 
 int cliser_server_broadcast(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    server_t *server = (server_t *)lua_touserdata(L, 1);
    const char *tag = luaL_optstring(L, 3, NULL);
    client_t **clients = alloca(server->num_clients * sizeof(client_t*));
@@ -713,82 +2534,688 @@ int cliser_server_broadcast(lua_State *L) {
       }
       client = client->next;
    }
+   // nobody to send to is not a broadcast, keep it out of netStats
+   if (i == 0) return 0;
+   op_timer_t timer;
+   op_timer_start(&timer, &server->copy_context, OP_BROADCAST);
+   int ret = flush_server_clients(L, server);
+   if (ret) return ret;
    qsort(clients, i, sizeof(client_t*), compare_clients);
-   int ret = 0;
+   // serialize once, flat CPU tensors and storages are sent straight from their memory
+   struct iovec payload[2];
+   int payload_count = 0;
+   size_t len = 0;
+   async_op_t *op = NULL;
+   if (lua_type(L, 2) == LUA_TUSERDATA) {
+      if (server->copy_context.wire_format == WIRE_FORMAT_NONE && luaL_getmetafield(L, 2, "_cliser_async")) {
+         op = create_async_op(1);
+         lua_pushvalue(L, 2);
+         lua_pushlightuserdata(L, op);
+         lua_call(L, 2, 1);
+         if (lua_toboolean(L, -1)) {
+            payload[0].iov_base = op->header;
+            payload[0].iov_len = op->header_len;
+            payload[1].iov_base = op->ptr;
+            payload[1].iov_len = op->len;
+            payload_count = op->len ? 2 : 1;
+            len = op->len;
+         }
+         lua_pop(L, 1);
+      }
+   } else {
+      ret = sock_pack_msg(L, 2, clients[0]->send_rb, &len);
+      if (ret) return ret;
+      payload[0].iov_base = &len;
+      payload[0].iov_len = sizeof(len);
+      payload[1].iov_base = ringbuffer_buf_ptr(clients[0]->send_rb);
+      payload[1].iov_len = len;
+      payload_count = 2;
+   }
+   broadcast_target_t *targets = alloca(i * sizeof(broadcast_target_t));
+   int num_targets = 0;
    for (int j = 0; j < i; j++) {
       client = clients[j];
-      if (lua_type(L, 2) == LUA_TUSERDATA) {
-         ret = sock_send_userdata(L, 2, client->sock, &server->copy_context);
-      } else {
-         ret = sock_send_msg(L, 2, client->sock, client->send_rb, &server->copy_context);
+      // anything that needs its own transfer path for this client goes one at a time below
+      if (payload_count == 0 || (op && (client->copy_context.use_fastpath || use_shm(&client->copy_context, len) || use_streams(&client->copy_context, len) || use_zerocopy(&server->copy_context, len)))) {
+         continue;
       }
+      targets[num_targets].sock = client->sock;
+      memcpy(targets[num_targets].iov, payload, sizeof(payload));
+      targets[num_targets].count = payload_count;
+      num_targets++;
+      clients[j] = NULL;
+   }
+   ret = sock_broadcast(L, targets, num_targets, &server->copy_context);
+   if (op) async_op_release(op);
+   if (ret) return ret;
+   for (int j = 0; j < i; j++) {
+      client = clients[j];
+      if (!client) continue;
+      use_client_copy_mode(server, client);
+      ret = sock_send_userdata(L, 2, client->sock, &server->copy_context);
       if (ret) break;
    }
-   server->copy_context.tx.total_seconds += (cliser_profile_seconds() - t0);
-   server->copy_context.tx.num_calls++;
+   op_timer_stop(&timer);
    return ret;
 }
 
-int cliser_server_recv_any(lua_State *L) {
-   double t0 = cliser_profile_seconds();
+// dense bytes behind a remote storage or tensor header of the same shape as ours
+static size_t async_payload_len(async_op_t *op, long *header) {
+   if (!op->element_size) return header[0] * header[1];
+   if (!(header[0] & 0x1) || (header[0] & 0x2)) return 0;
+   size_t len = (header[0] & 0xF0) >> 4;
+   for (size_t i = 1; i < op->header_len / sizeof(long); i += 2) {
+      len *= header[i];
+   }
+   return len;
+}
+
+// everything after the header of an async recv, also used by gather once it has read the header
+static const char *async_op_recv_payload(int sock, async_op_t *op, long *header, copy_context_t *copy_context) {
+   const char *error = NULL;
+   int wire_format = WIRE_FORMAT_NONE;
+   if (op->wire_element_size) {
+      // the sender picks the wire format, it is not part of the match
+      wire_format = (header[0] & 0xC) >> 2;
+      header[0] &= ~0xCL;
+   }
+   int sparse = SPARSE_NONE;
+   if (op->element_size) {
+      // and so is sparse or dense
+      sparse = (header[0] & 0x300) >> 8;
+      header[0] &= ~0x300L;
+   }
+   if (memcmp(header, op->header, op->header_len) != 0) {
+      if (wire_format == WIRE_FORMAT_NONE && sparse == SPARSE_NONE) {
+         shm_reject(sock, async_payload_len(op, header), copy_context);
+      }
+      error = "local and remote tensor headers do not match";
+   } else if (sparse != SPARSE_NONE) {
+      size_t count = op->len / op->element_size;
+      if (sock_recv_sparse(sock, op->ptr, count, op->element_size, (sparse == SPARSE_ROWS) ? op->row_len : 1, NULL, 0, copy_context) != count) {
+         error = "failed to recv the correct number of sparse bytes";
+      }
+   } else if (wire_format != WIRE_FORMAT_NONE) {
+      size_t count = op->len / op->wire_element_size;
+      if (sock_recv_wire(sock, op->ptr, count, op->wire_element_size, wire_format, copy_context) != count) {
+         error = "failed to recv the correct number of bytes";
+      }
+   } else if (use_shm(copy_context, op->len)) {
+      if (shm_recv(sock, op->ptr, op->len, copy_context) != op->len) {
+         error = "failed to recv the correct number of bytes through shared memory";
+      }
+   } else if (use_streams(copy_context, op->len)) {
+      if (sock_stripe(sock, op->ptr, op->len, 0, copy_context) != op->len) {
+         error = "failed to recv the correct number of bytes across streams";
+      }
+   } else if (sock_recv(sock, op->ptr, op->len, copy_context) != op->len) {
+      error = "failed to recv the correct number of bytes";
+   }
+   return error;
+}
+
+typedef struct gather_target_t {
+   client_t *client;
+   int index;
+   async_op_t *op;
+   long *header;
+   size_t got;
+   int state;
+} gather_target_t;
+
+#define GATHER_HEADER (0)
+#define GATHER_PAYLOAD (1)
+#define GATHER_DONE (2)
+#define GATHER_SEQUENTIAL (3)
+#define GATHER_ENCODED (4)
+
+// reads every target at once, whichever socket has data goes next so one slow
+// client does not hold up the rest, a sender that picked a wire format or a
+// sparse encoding has its payload read after the others
+static const char *sock_gather(gather_target_t *targets, int num_targets, copy_context_t *copy_context) {
+   struct pollfd *fds = alloca(num_targets * sizeof(struct pollfd));
+   int *which = alloca(num_targets * sizeof(int));
+   int remaining = 0;
+   for (int i = 0; i < num_targets; i++) {
+      if (targets[i].state == GATHER_HEADER) remaining++;
+   }
+   while (remaining > 0) {
+      int nfds = 0;
+      for (int i = 0; i < num_targets; i++) {
+         if (targets[i].state == GATHER_HEADER || targets[i].state == GATHER_PAYLOAD) {
+            fds[nfds].fd = targets[i].client->sock;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            which[nfds] = i;
+            nfds++;
+         }
+      }
+      int ret = poll(fds, nfds, -1);
+      if (ret < 0) {
+         if (errno == EINTR) continue;
+         return strerror(errno);
+      }
+      for (int j = 0; j < nfds; j++) {
+         if (!fds[j].revents) continue;
+         if (fds[j].revents & (POLLERR | POLLNVAL)) return "client disconnected during gather";
+         gather_target_t *target = &targets[which[j]];
+         async_op_t *op = target->op;
+         int sock = target->client->sock;
+         double t0 = syscall_seconds();
+         ssize_t got;
+         if (target->state == GATHER_HEADER) {
+            got = recv(sock, (uint8_t *)target->header + target->got, op->header_len - target->got, MSG_DONTWAIT);
+         } else {
+            got = recv(sock, (uint8_t *)op->ptr + target->got, op->len - target->got, MSG_DONTWAIT);
+         }
+         copy_context->rx.system_seconds += syscall_elapsed(t0);
+         copy_context->rx.num_system_calls++;
+         if (got == 0) return "client disconnected during gather";
+         if (got < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            return strerror(errno);
+         }
+         copy_context->rx.num_bytes += got;
+         target->got += got;
+         if (target->state == GATHER_PAYLOAD) {
+            if (target->got == op->len) {
+               target->state = GATHER_DONE;
+               remaining--;
+            }
+            continue;
+         }
+         // a split header is taken a piece at a time like the payload
+         if (target->got < op->header_len) continue;
+         target->got = 0;
+         copy_context->rx.num_regions++;
+         if ((op->wire_element_size && (target->header[0] & 0xC)) || (op->element_size && (target->header[0] & 0x300))) {
+            target->state = GATHER_ENCODED;
+            remaining--;
+            continue;
+         }
+         if (memcmp(target->header, op->header, op->header_len) != 0) return "local and remote tensor headers do not match";
+         target->state = op->len ? GATHER_PAYLOAD : GATHER_DONE;
+         if (target->state == GATHER_DONE) remaining--;
+      }
+   }
+   return NULL;
+}
+
+int cliser_server_gather(lua_State *L) {
    server_t *server = (server_t *)lua_touserdata(L, 1);
-   const char *tag = luaL_optstring(L, 2, NULL);
-   fd_set fds;
-   FD_ZERO(&fds);
-   int highest = -1;
+   luaL_checktype(L, 2, LUA_TTABLE);
+   op_timer_t timer;
+   op_timer_start(&timer, &server->copy_context, OP_GATHER);
+   const char *tag = luaL_optstring(L, 3, NULL);
+   int ret = flush_server_clients(L, server);
+   if (ret) return ret;
+   client_t **clients = alloca(server->num_clients * sizeof(client_t*));
    client_t *client = server->clients;
+   int n = 0;
    while (client) {
       if (!tag || (client->tag && strcmp(tag, client->tag) == 0)) {
-         FD_SET(client->sock, &fds);
-         if (client->sock > highest) {
-            highest = client->sock;
-         }
+         clients[n] = client;
+         n++;
       }
       client = client->next;
    }
-   int ret = select(highest + 1, &fds, NULL, NULL, NULL);
-   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
-   client = server->clients;
+   // the tensors line up with the clients in id order, same as broadcast
+   qsort(clients, n, sizeof(client_t*), compare_clients);
+   luaL_checkstack(L, n, "too many clients to gather from");
+   int base = lua_gettop(L);
+   for (int i = 0; i < n; i++) {
+      lua_rawgeti(L, 2, i + 1);
+      if (lua_type(L, -1) != LUA_TUSERDATA) return LUA_HANDLE_ERROR_STR(L, "expected a tensor or storage for every client");
+   }
+   gather_target_t *targets = alloca(n * sizeof(gather_target_t));
+   memset(targets, 0, n * sizeof(gather_target_t));
+   for (int i = 0; i < n; i++) {
+      targets[i].client = clients[i];
+      targets[i].index = base + i + 1;
+      targets[i].state = GATHER_SEQUENTIAL;
+      if (!luaL_getmetafield(L, targets[i].index, "_cliser_async")) continue;
+      async_op_t *op = create_async_op(0);
+      lua_pushvalue(L, targets[i].index);
+      lua_pushlightuserdata(L, op);
+      lua_call(L, 2, 1);
+      int flat = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+      targets[i].op = op;
+      // anything that needs its own transfer path for this client goes one at a time below
+      copy_context_t *copy_context = &clients[i]->copy_context;
+      if (!flat || copy_context->use_fastpath || use_shm(copy_context, op->len) || use_streams(copy_context, op->len)) continue;
+      targets[i].header = alloca(op->header_len);
+      targets[i].state = GATHER_HEADER;
+   }
+   const char *error = sock_gather(targets, n, &server->copy_context);
+   for (int i = 0; i < n; i++) {
+      if (!error && targets[i].state == GATHER_ENCODED) {
+         use_client_copy_mode(server, targets[i].client);
+         error = async_op_recv_payload(targets[i].client->sock, targets[i].op, targets[i].header, &server->copy_context);
+      }
+      if (targets[i].op) async_op_release(targets[i].op);
+   }
+   if (error) return LUA_HANDLE_ERROR_STR(L, error);
+   for (int i = 0; i < n; i++) {
+      if (targets[i].state != GATHER_SEQUENTIAL) continue;
+      use_client_copy_mode(server, targets[i].client);
+      lua_pushvalue(L, targets[i].index);
+      ret = sock_recv_userdata(L, lua_gettop(L), targets[i].client->sock, &server->copy_context);
+      lua_pop(L, 1);
+      if (ret) return ret;
+   }
+   op_timer_stop(&timer);
+   lua_pushinteger(L, n);
+   return 1;
+}
+
+// fills ready with up to max clients that have something to read, in no
+// particular order, waiting at most timeout ms for the first one
+static int wait_ready_clients(lua_State *L, server_t *server, const char *tag, int timeout, client_t **ready, uint32_t max, uint32_t *num_ready) {
+   *num_ready = 0;
+   if (max == 0) return 0;
+#ifndef __APPLE__
+   if (!tag && !server->epoll_failed) {
+      struct epoll_event *events = alloca(max * sizeof(struct epoll_event));
+      int ret = epoll_wait(server->epfd, events, max, timeout);
+      if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
+      for (int i = 0; i < ret; i++) {
+         ready[i] = (client_t *)events[i].data.ptr;
+      }
+      *num_ready = ret;
+      return 0;
+   }
+#endif
+   // tagged waits only care about a subset of the clients, poll just those;
+   // untagged waits end up here too once a client could not join the epoll set
+   struct pollfd *fds = alloca(server->num_clients * sizeof(struct pollfd));
+   client_t **clients = alloca(server->num_clients * sizeof(client_t*));
+   nfds_t n = 0;
+   client_t *client = server->clients;
    while (client) {
       if (!tag || (client->tag && strcmp(tag, client->tag) == 0)) {
-         if (FD_ISSET(client->sock, &fds)) {
-            ret = sock_recv_msg(L, client->sock, client->recv_rb, &server->copy_context);
+         fds[n].fd = client->sock;
+         fds[n].events = POLLIN;
+         fds[n].revents = 0;
+         clients[n] = client;
+         n++;
+      }
+      client = client->next;
+   }
+   int ret = poll(fds, n, timeout);
+   if (ret < 0) return LUA_HANDLE_ERROR(L, errno);
+   for (nfds_t i = 0; i < n && *num_ready < max; i++) {
+      if (fds[i].revents) {
+         ready[(*num_ready)++] = clients[i];
+      }
+   }
+   return 0;
+}
+
+static void push_server_client(lua_State *L, server_t *server, client_t *client) {
+   server_client_t *server_client = (server_client_t *)lua_newuserdata(L, sizeof(server_client_t));
+   server_client->server = server;
+   server_client->client = client;
+   luaL_getmetatable(L, "ipc.server.client");
+   lua_setmetatable(L, -2);
+}
+
+// puts the ready clients in client list order, starting after the one served last,
+// so each gets its turn however the wait happened to report them
+static void order_ready_clients(server_t *server, client_t **ready, uint32_t num_ready) {
+   for (uint32_t i = 0; i < num_ready; i++) {
+      ready[i]->turn_ready = 1;
+   }
+   client_t *client = (server->last_served && server->last_served->next) ? server->last_served->next : server->clients;
+   uint32_t n = 0;
+   for (uint32_t i = 0; i < server->num_clients && n < num_ready; i++) {
+      if (client->turn_ready) {
+         client->turn_ready = 0;
+         ready[n++] = client;
+      }
+      client = client->next ? client->next : server->clients;
+   }
+}
+
+int cliser_server_recv_any(lua_State *L) {
+   server_t *server = (server_t *)lua_touserdata(L, 1);
+   op_timer_t timer;
+   op_timer_start(&timer, &server->copy_context, OP_RECV_ANY);
+   const char *tag = luaL_optstring(L, 2, NULL);
+   int ret = flush_server_clients(L, server);
+   if (ret) return ret;
+   client_t **ready = alloca(server->num_clients * sizeof(client_t *));
+   uint32_t num_ready;
+   while (server->num_clients) {
+      ret = wait_ready_clients(L, server, tag, -1, ready, server->num_clients, &num_ready);
+      if (ret) return ret;
+      order_ready_clients(server, ready, num_ready);
+      for (uint32_t i = 0; i < num_ready; i++) {
+         client_t *client = ready[i];
+         if (sock_recv_msg_partial(L, client, &server->copy_context)) {
+            server->last_served = client;
+            ret = client_load_msg(L, client);
             if (ret == 1) {
-               server_client_t *server_client = (server_client_t *)lua_newuserdata(L, sizeof(server_client_t));
-               server_client->server = server;
-               server_client->client = client;
-               luaL_getmetatable(L, "ipc.server.client");
-               lua_setmetatable(L, -2);
+               push_server_client(L, server, client);
                ret = 2;
             }
-            break;
+            op_timer_stop(&timer);
+            return ret;
          }
       }
-      client = client->next;
    }
-   server->copy_context.rx.total_seconds += (cliser_profile_seconds() - t0);
-   server->copy_context.rx.num_calls++;
-   return ret;
+   op_timer_stop(&timer);
+   return 0;
+}
+
+int cliser_server_recv_all(lua_State *L) {
+   server_t *server = (server_t *)lua_touserdata(L, 1);
+   op_timer_t timer;
+   op_timer_start(&timer, &server->copy_context, OP_RECV_ALL);
+   const char *tag = luaL_optstring(L, 2, NULL);
+   int ret = flush_server_clients(L, server);
+   if (ret) return ret;
+   client_t **ready = alloca(server->num_clients * sizeof(client_t *));
+   uint32_t num_ready;
+   lua_newtable(L);
+   int msgs = lua_gettop(L);
+   lua_newtable(L);
+   int clients = lua_gettop(L);
+   int n = 0;
+   while (n == 0 && server->num_clients) {
+      ret = wait_ready_clients(L, server, tag, -1, ready, server->num_clients, &num_ready);
+      if (ret) return ret;
+      order_ready_clients(server, ready, num_ready);
+      for (uint32_t i = 0; i < num_ready; i++) {
+         client_t *client = ready[i];
+         // keep going while whole messages are already sitting in the socket
+         while (sock_recv_msg_partial(L, client, &server->copy_context)) {
+            ret = client_load_msg(L, client);
+            if (ret != 1) return LUA_HANDLE_ERROR_STR(L, "expected a single value per message");
+            n++;
+            lua_rawseti(L, msgs, n);
+            push_server_client(L, server, client);
+            lua_rawseti(L, clients, n);
+         }
+      }
+   }
+   op_timer_stop(&timer);
+   return 2;
+}
+
+static const char *async_op_run(async_io_t *io, async_op_t *op) {
+   copy_context_t *copy_context = io->copy_context;
+   op_timer_t timer;
+   op_timer_start(&timer, copy_context, op->is_send ? OP_SEND : OP_RECV);
+   const char *error = NULL;
+   if (op->is_send) {
+      if (op->wire_format != WIRE_FORMAT_NONE) {
+         size_t count = op->len / op->wire_element_size;
+         if (sock_send(io->sock, op->header, op->header_len, copy_context) != op->header_len) {
+            error = "failed to send the correct number of bytes";
+         } else if (sock_send_wire(io->sock, op->ptr, count, op->wire_element_size, op->wire_format, copy_context) != count) {
+            error = "failed to send the correct number of bytes";
+         }
+      } else if (use_shm(copy_context, op->len)) {
+         if (sock_send(io->sock, op->header, op->header_len, copy_context) != op->header_len) {
+            error = "failed to send the correct number of bytes";
+         } else if (shm_send(io->sock, op->ptr, op->len, copy_context) != op->len) {
+            error = "failed to send the correct number of bytes through shared memory";
+         }
+      } else if (use_streams(copy_context, op->len)) {
+         if (sock_send(io->sock, op->header, op->header_len, copy_context) != op->header_len) {
+            error = "failed to send the correct number of bytes";
+         } else if (sock_stripe(io->sock, op->ptr, op->len, 1, copy_context) != op->len) {
+            error = "failed to send the correct number of bytes across streams";
+         }
+      } else if (use_zerocopy(copy_context, op->len)) {
+         if (sock_send(io->sock, op->header, op->header_len, copy_context) != op->header_len) {
+            error = "failed to send the correct number of bytes";
+         } else if (sock_send_zerocopy(io->sock, op->ptr, op->len, copy_context) != op->len) {
+            error = "failed to send the correct number of bytes";
+         }
+      } else {
+         struct iovec iov[2];
+         iov[0].iov_base = op->header;
+         iov[0].iov_len = op->header_len;
+         iov[1].iov_base = op->ptr;
+         iov[1].iov_len = op->len;
+         if (sock_sendv(io->sock, iov, op->len ? 2 : 1, copy_context) != op->header_len + op->len) {
+            error = "failed to send the correct number of bytes";
+         }
+      }
+   } else {
+      long *header = alloca(op->header_len);
+      if (sock_recv(io->sock, header, op->header_len, copy_context) != op->header_len) {
+         error = "failed to recv the correct number of bytes";
+      } else {
+         error = async_op_recv_payload(io->sock, op, header, copy_context);
+      }
+   }
+   op_timer_stop(&timer);
+   return error;
+}
+
+static void *async_io_thread(void *arg) {
+   async_io_t *io = (async_io_t *)arg;
+   pthread_mutex_lock(&io->mutex);
+   while (1) {
+      while (!io->head && io->running) {
+         pthread_cond_wait(&io->cond, &io->mutex);
+      }
+      if (!io->head) break;
+      async_op_t *op = io->head;
+      pthread_mutex_unlock(&io->mutex);
+      const char *error = async_op_run(io, op);
+      pthread_mutex_lock(&op->mutex);
+      op->error = error;
+      op->done = 1;
+      pthread_cond_broadcast(&op->done_cond);
+      pthread_mutex_unlock(&op->mutex);
+      pthread_mutex_lock(&io->mutex);
+      io->head = op->next;
+      if (!io->head) io->tail = NULL;
+      io->pending--;
+      pthread_cond_broadcast(&io->cond);
+      async_op_release(op);
+   }
+   pthread_mutex_unlock(&io->mutex);
+   return NULL;
+}
+
+static int get_async_io(lua_State *L, client_t *client, async_io_t **iop) {
+   if (!client->async_io) {
+      async_io_t *io = (async_io_t *)calloc(1, sizeof(async_io_t));
+      pthread_mutex_init(&io->mutex, NULL);
+      pthread_cond_init(&io->cond, NULL);
+      io->running = 1;
+      io->sock = client->sock;
+      io->copy_context = &client->copy_context;
+      int ret = pthread_create(&io->thread, NULL, async_io_thread, io);
+      if (ret) {
+         pthread_mutex_destroy(&io->mutex);
+         pthread_cond_destroy(&io->cond);
+         free(io);
+         return LUA_HANDLE_ERROR(L, ret);
+      }
+      client->async_io = io;
+   }
+   *iop = client->async_io;
+   return 0;
+}
+
+// blocking calls must not interleave their bytes with queued transfers
+static void drain_async_io(client_t *client) {
+   async_io_t *io = client->async_io;
+   if (!io) return;
+   pthread_mutex_lock(&io->mutex);
+   while (io->pending) {
+      pthread_cond_wait(&io->cond, &io->mutex);
+   }
+   pthread_mutex_unlock(&io->mutex);
+}
+
+static void destroy_async_io(client_t *client) {
+   async_io_t *io = client->async_io;
+   if (!io) return;
+   pthread_mutex_lock(&io->mutex);
+   io->running = 0;
+   pthread_cond_broadcast(&io->cond);
+   pthread_mutex_unlock(&io->mutex);
+   pthread_join(io->thread, NULL);
+   pthread_mutex_destroy(&io->mutex);
+   pthread_cond_destroy(&io->cond);
+   free(io);
+   client->async_io = NULL;
+}
+
+static int push_async_handle(lua_State *L, int index, async_op_t *op) {
+   async_handle_t *handle = (async_handle_t *)lua_newuserdata(L, sizeof(async_handle_t));
+   handle->op = op;
+   lua_pushvalue(L, index);
+   handle->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+   luaL_getmetatable(L, "ipc.client.handle");
+   lua_setmetatable(L, -2);
+   return 1;
+}
+
+static int cliser_client_async(lua_State *L, client_t *client, int is_send) {
+   async_io_t *io;
+   // corked bytes go out ahead of this transfer, never in the middle of a queued one
+   if (ringbuffer_peek(client->send_rb)) drain_async_io(client);
+   int ret = flush_client(L, client, &client->copy_context);
+   if (ret) return ret;
+   ret = get_async_io(L, client, &io);
+   if (ret) return ret;
+   async_op_t *op = create_async_op(is_send);
+   op->use_fastpath = client->copy_context.use_fastpath;
+   op->wire_format = (is_send && (client->copy_context.features & FEATURE_WIRE)) ? client->copy_context.wire_format : WIRE_FORMAT_NONE;
+   int queued = 0;
+   // ranged transfers take the blocking path below, the queue only moves whole values
+   if (lua_type(L, 3) != LUA_TNUMBER && luaL_getmetafield(L, 2, "_cliser_async")) {
+      lua_pushvalue(L, 2);
+      lua_pushlightuserdata(L, op);
+      if (lua_pcall(L, 2, 1, 0)) {
+         // nobody else has seen the op yet
+         async_op_release(op);
+         return lua_error(L);
+      }
+      queued = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+   }
+   if (!queued) {
+      // not a flat CPU buffer, do the transfer now and hand back a completed handle
+      async_op_release(op);
+      drain_async_io(client);
+      op_timer_t timer;
+      op_timer_start(&timer, &client->copy_context, is_send ? OP_SEND : OP_RECV);
+      if (is_send) {
+         sock_send_userdata(L, 2, client->sock, &client->copy_context);
+      } else {
+         sock_recv_userdata(L, 2, client->sock, &client->copy_context);
+      }
+      op_timer_stop(&timer);
+      op = create_async_op(is_send);
+      op->done = 1;
+      return push_async_handle(L, 2, op);
+   }
+   op->ref_count++;
+   pthread_mutex_lock(&io->mutex);
+   if (io->tail) {
+      io->tail->next = op;
+   } else {
+      io->head = op;
+   }
+   io->tail = op;
+   io->pending++;
+   pthread_cond_broadcast(&io->cond);
+   pthread_mutex_unlock(&io->mutex);
+   return push_async_handle(L, 2, op);
+}
+
+int cliser_client_send_async(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   if (lua_type(L, 2) != LUA_TUSERDATA) return LUA_HANDLE_ERROR_STR(L, "sendAsync expects a tensor or storage");
+   return cliser_client_async(L, client, 1);
+}
+
+static async_handle_t *check_async_handle(lua_State *L) {
+   return (async_handle_t *)luaL_checkudata(L, 1, "ipc.client.handle");
+}
+
+static const char *wait_async_handle(async_handle_t *handle) {
+   async_op_t *op = handle->op;
+   pthread_mutex_lock(&op->mutex);
+   while (!op->done) {
+      pthread_cond_wait(&op->done_cond, &op->mutex);
+   }
+   const char *error = op->error;
+   pthread_mutex_unlock(&op->mutex);
+   return error;
+}
+
+static void release_async_handle(lua_State *L, async_handle_t *handle) {
+   luaL_unref(L, LUA_REGISTRYINDEX, handle->ref);
+   handle->ref = LUA_NOREF;
+   async_op_release(handle->op);
+   handle->op = NULL;
+}
+
+int cliser_client_handle_wait(lua_State *L) {
+   async_handle_t *handle = check_async_handle(L);
+   if (!handle->op) return LUA_HANDLE_ERROR_STR(L, "handle has already been waited on");
+   const char *error = wait_async_handle(handle);
+   lua_rawgeti(L, LUA_REGISTRYINDEX, handle->ref);
+   release_async_handle(L, handle);
+   if (error) return LUA_HANDLE_ERROR_STR(L, error);
+   return 1;
+}
+
+int cliser_client_handle_test(lua_State *L) {
+   async_handle_t *handle = check_async_handle(L);
+   int done = 1;
+   if (handle->op) {
+      pthread_mutex_lock(&handle->op->mutex);
+      done = handle->op->done;
+      pthread_mutex_unlock(&handle->op->mutex);
+   }
+   lua_pushboolean(L, done);
+   return 1;
+}
+
+int cliser_client_handle_gc(lua_State *L) {
+   async_handle_t *handle = check_async_handle(L);
+   if (handle->op) {
+      // the transfer still references the tensor memory, so let it finish
+      wait_async_handle(handle);
+      release_async_handle(L, handle);
+   }
+   return 0;
 }
 
 int cliser_client_send(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   op_timer_t timer;
+   op_timer_start(&timer, &client->copy_context, OP_SEND);
    int ret;
    if (lua_type(L, 2) == LUA_TUSERDATA) {
-      ret = sock_send_userdata(L, 2, client->sock, &client->copy_context);
+      ret = flush_client(L, client, &client->copy_context);
+      if (ret == 0) ret = sock_send_userdata(L, 2, client->sock, &client->copy_context);
    } else {
-      ret = sock_send_msg(L, 2, client->sock, client->send_rb, &client->copy_context);
+      ret = client_send_msg(L, 2, client, &client->copy_context);
    }
-   client->copy_context.tx.total_seconds += (cliser_profile_seconds() - t0);
-   client->copy_context.tx.num_calls++;
+   op_timer_stop(&timer);
    return ret;
 }
 
 int cliser_client_recv(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    client_t *client = *(client_t **)lua_touserdata(L, 1);
-   int ret;
+   drain_async_io(client);
+   op_timer_t timer;
+   op_timer_start(&timer, &client->copy_context, OP_RECV);
+   int ret = flush_client(L, client, &client->copy_context);
+   if (ret) return ret;
    if (lua_type(L, 2) == LUA_TUSERDATA) {
       ret = sock_recv_userdata(L, 2, client->sock, &client->copy_context);
       if (ret == 0) {
@@ -796,22 +3223,43 @@ int cliser_client_recv(lua_State *L) {
          ret = 1;
       }
    } else {
-      ret = sock_recv_msg(L, client->sock, client->recv_rb, &client->copy_context);
+      ret = client_recv_msg(L, client, &client->copy_context);
    }
-   client->copy_context.rx.total_seconds += (cliser_profile_seconds() - t0);
-   client->copy_context.rx.num_calls++;
+   op_timer_stop(&timer);
+   return ret;
+}
+
+int cliser_client_recv_reduce(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   op_timer_t timer;
+   op_timer_start(&timer, &client->copy_context, OP_RECV);
+   int ret = flush_client(L, client, &client->copy_context);
+   if (ret) return ret;
+   ret = sock_recv_reduce_userdata(L, 2, client->sock, &client->copy_context);
+   if (ret == 0) {
+      lua_pushvalue(L, 2);
+      ret = 1;
+   }
+   op_timer_stop(&timer);
    return ret;
 }
 
 int cliser_client_recv_async(lua_State *L) {
-   double t0 = cliser_profile_seconds();
    client_t *client = *(client_t **)lua_touserdata(L, 1);
-   int ret = sock_recv_msg_peek(L, client->sock, client->recv_rb);
+   if (lua_type(L, 2) == LUA_TUSERDATA) {
+      return cliser_client_async(L, client, 0);
+   }
+   drain_async_io(client);
+   op_timer_t timer;
+   op_timer_start(&timer, &client->copy_context, OP_RECV);
+   int ret = flush_client(L, client, &client->copy_context);
+   if (ret) return ret;
+   ret = sock_recv_msg_partial(L, client, &client->copy_context);
    if (ret > 0) {
-      ret = sock_recv_msg(L, client->sock, client->recv_rb, &client->copy_context);
+      ret = client_load_msg(L, client);
    }
-   client->copy_context.rx.total_seconds += (cliser_profile_seconds() - t0);
-   client->copy_context.rx.num_calls++;
+   op_timer_stop(&timer);
    return ret;
 }
 
@@ -844,6 +3292,18 @@ int cliser_net_stats_inner(lua_State *L, net_stats_t *net_stats) {
    lua_pushstring(L, "cuda_ipc_bytes");
    lua_pushnumber(L, net_stats->cuda_ipc_bytes);
    lua_settable(L, -3);
+   lua_pushstring(L, "zerocopy_bytes");
+   lua_pushnumber(L, net_stats->zerocopy_bytes);
+   lua_settable(L, -3);
+   lua_pushstring(L, "zerocopy_copied");
+   lua_pushnumber(L, net_stats->zerocopy_copied);
+   lua_settable(L, -3);
+   lua_pushstring(L, "shm_seconds");
+   lua_pushnumber(L, net_stats->shm_seconds);
+   lua_settable(L, -3);
+   lua_pushstring(L, "shm_bytes");
+   lua_pushnumber(L, net_stats->shm_bytes);
+   lua_settable(L, -3);
    lua_pushstring(L, "NETWORK MB/s");
    lua_pushnumber(L, ((double)net_stats->num_bytes / (1024.0*1024.0)) / net_stats->total_seconds);
    lua_settable(L, -3);
@@ -853,6 +3313,41 @@ int cliser_net_stats_inner(lua_State *L, net_stats_t *net_stats) {
    return 1;
 }
 
+static void cliser_percentiles(lua_State *L, histogram_t *histogram, double scale) {
+   lua_newtable(L);
+   lua_pushstring(L, "p50");
+   lua_pushnumber(L, histogram_percentile(histogram, 0.5) * scale);
+   lua_settable(L, -3);
+   lua_pushstring(L, "p99");
+   lua_pushnumber(L, histogram_percentile(histogram, 0.99) * scale);
+   lua_settable(L, -3);
+   lua_pushstring(L, "p999");
+   lua_pushnumber(L, histogram_percentile(histogram, 0.999) * scale);
+   lua_settable(L, -3);
+}
+
+static const char *op_names[NUM_OPS] = { "send", "recv", "broadcast", "recvAny", "recvAll", "gather" };
+
+static void cliser_op_stats(lua_State *L, op_stats_t *op_stats) {
+   lua_newtable(L);
+   if (!op_stats) return;
+   for (int i = 0; i < NUM_OPS; i++) {
+      if (op_stats->latency[i].count == 0) continue;
+      lua_pushstring(L, op_names[i]);
+      lua_newtable(L);
+      lua_pushstring(L, "count");
+      lua_pushnumber(L, op_stats->latency[i].count);
+      lua_settable(L, -3);
+      lua_pushstring(L, "seconds");
+      cliser_percentiles(L, &op_stats->latency[i], 1e-9);
+      lua_settable(L, -3);
+      lua_pushstring(L, "bytes");
+      cliser_percentiles(L, &op_stats->size[i], 1);
+      lua_settable(L, -3);
+      lua_settable(L, -3);
+   }
+}
+
 int cliser_net_stats(lua_State *L, copy_context_t *copy_context) {
    lua_newtable(L);
    lua_pushstring(L, "tx");
@@ -861,9 +3356,96 @@ int cliser_net_stats(lua_State *L, copy_context_t *copy_context) {
    lua_pushstring(L, "rx");
    cliser_net_stats_inner(L, &copy_context->rx);
    lua_settable(L, -3);
+   lua_pushstring(L, "ops");
+   cliser_op_stats(L, copy_context->op_stats);
+   lua_settable(L, -3);
+   return 1;
+}
+
+int cliser_net_timing(lua_State *L) {
+   if (!lua_isnoneornil(L, 1)) {
+      THAtomicSet(&syscall_timing, lua_toboolean(L, 1));
+   }
+   lua_pushboolean(L, THAtomicGet(&syscall_timing));
+   return 1;
+}
+
+int cliser_server_zero_copy(lua_State *L) {
+   server_t *server = (server_t *)lua_touserdata(L, 1);
+   server->copy_context.zerocopy_threshold = luaL_optinteger(L, 2, 0);
+   if (server->copy_context.zerocopy_threshold) {
+      for (client_t *client = server->clients; client; client = client->next) {
+         enable_zerocopy(client);
+      }
+   }
+   return 0;
+}
+
+int cliser_client_zero_copy(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   client->copy_context.zerocopy_threshold = luaL_optinteger(L, 2, 0);
+   // tell the caller whether the socket can actually do it
+   lua_pushboolean(L, client->copy_context.zerocopy_threshold && enable_zerocopy(client));
    return 1;
 }
 
+int cliser_server_sparse(lua_State *L) {
+   server_t *server = (server_t *)lua_touserdata(L, 1);
+   server->copy_context.use_sparse = lua_toboolean(L, 2);
+   return 0;
+}
+
+int cliser_client_sparse(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   client->copy_context.use_sparse = lua_toboolean(L, 2);
+   return 0;
+}
+
+int cliser_server_client_cork(lua_State *L) {
+   server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
+   if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
+   server_client->client->corked = 1;
+   return 0;
+}
+
+int cliser_server_client_flush(lua_State *L) {
+   server_client_t *server_client = (server_client_t *)lua_touserdata(L, 1);
+   if (server_client->client == NULL) return LUA_HANDLE_ERROR_STR(L, "server client is invalid, either closed or used outside of server function scope");
+   server_client->client->corked = 0;
+   return flush_client(L, server_client->client, &server_client->server->copy_context);
+}
+
+int cliser_client_cork(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   client->corked = 1;
+   return 0;
+}
+
+int cliser_client_flush(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   client->corked = 0;
+   return flush_client(L, client, &client->copy_context);
+}
+
+static const char *wire_formats[] = { "none", "fp16", "bf16", NULL };
+static const char *reduce_ops[] = { "sum", "prod", "max", "min", NULL };
+
+int cliser_server_wire_format(lua_State *L) {
+   server_t *server = (server_t *)lua_touserdata(L, 1);
+   server->copy_context.wire_format = luaL_checkoption(L, 2, "none", wire_formats);
+   return 0;
+}
+
+int cliser_client_wire_format(lua_State *L) {
+   client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
+   client->copy_context.wire_format = luaL_checkoption(L, 2, "none", wire_formats);
+   return 0;
+}
+
 int cliser_server_net_stats(lua_State *L) {
    server_t *server = (server_t *)lua_touserdata(L, 1);
    return cliser_net_stats(L, &server->copy_context);
@@ -871,6 +3453,7 @@ int cliser_server_net_stats(lua_State *L) {
 
 int cliser_client_net_stats(lua_State *L) {
    client_t *client = *(client_t **)lua_touserdata(L, 1);
+   drain_async_io(client);
    return cliser_net_stats(L, &client->copy_context);
 }
 
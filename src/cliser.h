@@ -10,20 +10,42 @@ int cliser_server_tag(lua_State *L);
 int cliser_server_id(lua_State *L);
 int cliser_server_client_close(lua_State *L);
 int cliser_server_client_address(lua_State *L);
+int cliser_server_client_features(lua_State *L);
+int cliser_server_client_cork(lua_State *L);
+int cliser_server_client_flush(lua_State *L);
 int cliser_server_broadcast(lua_State *L);
+int cliser_server_gather(lua_State *L);
 int cliser_server_recv_any(lua_State *L);
+int cliser_server_recv_all(lua_State *L);
 int cliser_server_send(lua_State *L);
 int cliser_server_recv(lua_State *L);
+int cliser_server_recv_reduce(lua_State *L);
 int cliser_server_net_stats(lua_State *L);
+int cliser_server_zero_copy(lua_State *L);
+int cliser_server_wire_format(lua_State *L);
+int cliser_server_sparse(lua_State *L);
+
+int cliser_net_timing(lua_State *L);
 
 int cliser_client(lua_State *L);
 int cliser_client_close(lua_State *L);
 int cliser_client_send(lua_State *L);
 int cliser_client_recv(lua_State *L);
+int cliser_client_recv_reduce(lua_State *L);
 int cliser_client_recv_async(lua_State *L);
+int cliser_client_send_async(lua_State *L);
 int cliser_client_retain(lua_State *L);
 int cliser_client_metatablename(lua_State *L);
 int cliser_client_net_stats(lua_State *L);
+int cliser_client_zero_copy(lua_State *L);
+int cliser_client_wire_format(lua_State *L);
+int cliser_client_sparse(lua_State *L);
+int cliser_client_features(lua_State *L);
+int cliser_client_cork(lua_State *L);
+int cliser_client_flush(lua_State *L);
+int cliser_client_handle_wait(lua_State *L);
+int cliser_client_handle_test(lua_State *L);
+int cliser_client_handle_gc(lua_State *L);
 
 void Lcliser_CharInit(lua_State *L);
 void Lcliser_ByteInit(lua_State *L);
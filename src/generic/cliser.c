@@ -27,6 +27,13 @@
    #define ELEMENT_SIZE (sizeof(double))
 #endif
 
+#ifdef CLISER_WIRE_REAL
+   #undef CLISER_WIRE_REAL
+#endif
+#if !defined(CLISER_IS_CUDA) && (defined(TH_REAL_IS_FLOAT) || defined(TH_REAL_IS_DOUBLE))
+   #define CLISER_WIRE_REAL
+#endif
+
 #ifdef CLISER_IS_CUDA
 #define CUDA_BLOCK_SIZE (512*1024)
 #define CUDA_BLOCK_COUNT (CUDA_BLOCK_SIZE/ELEMENT_SIZE)
@@ -200,6 +207,99 @@ static int Lcliser_(read_contiguous)(lua_State *L, int sock, real *ptr, size_t c
 
 #endif
 
+static int Lcliser_(wire_format)(copy_context_t *copy_context) {
+#ifdef CLISER_WIRE_REAL
+   // an older peer that cannot decode it gets full precision
+   if (!(copy_context->features & FEATURE_WIRE)) return WIRE_FORMAT_NONE;
+   return copy_context->wire_format;
+#else
+   (void)copy_context;
+   return WIRE_FORMAT_NONE;
+#endif
+}
+
+static int Lcliser_(write_region)(lua_State *L, int sock, iov_batch_t *batch, real *ptr, size_t count, int wire_format, copy_context_t *copy_context) {
+#ifdef CLISER_IS_CUDA
+   (void)wire_format;
+   int ret = iov_batch_flush(L, sock, batch, copy_context);
+   if (ret) return ret;
+   return Lcliser_(write_contiguous)(L, sock, ptr, count, copy_context);
+#else
+   if (wire_format != WIRE_FORMAT_NONE) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      if (sock_send_wire(sock, ptr, count, ELEMENT_SIZE, wire_format, copy_context) != count) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of bytes");
+      return 0;
+   }
+   return iov_batch_add(L, sock, batch, ptr, count * ELEMENT_SIZE, copy_context);
+#endif
+}
+
+static int Lcliser_(read_region)(lua_State *L, int sock, iov_batch_t *batch, real *ptr, size_t count, int wire_format, reduce_fn_t reduce, copy_context_t *copy_context) {
+#ifdef CLISER_IS_CUDA
+   (void)wire_format;
+   (void)reduce;
+   int ret = iov_batch_flush(L, sock, batch, copy_context);
+   if (ret) return ret;
+   return Lcliser_(read_contiguous)(L, sock, ptr, count, copy_context);
+#else
+   if (wire_format != WIRE_FORMAT_NONE) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      if (sock_recv_wire_reduce(sock, ptr, count, ELEMENT_SIZE, wire_format, reduce, copy_context) != count) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of bytes");
+      return 0;
+   }
+   if (reduce) {
+      int ret = iov_batch_flush(L, sock, batch, copy_context);
+      if (ret) return ret;
+      return sock_recv_reduce(L, sock, ptr, count * ELEMENT_SIZE, ELEMENT_SIZE, reduce, copy_context);
+   }
+   return iov_batch_add(L, sock, batch, ptr, count * ELEMENT_SIZE, copy_context);
+#endif
+}
+
+#ifndef CLISER_IS_CUDA
+static void Lcliser_(reduce_sum)(void *dst, const void *src, size_t count) {
+   real *d = (real *)dst;
+   const real *s = (const real *)src;
+   for (size_t i = 0; i < count; i++) {
+      d[i] += s[i];
+   }
+}
+
+static void Lcliser_(reduce_prod)(void *dst, const void *src, size_t count) {
+   real *d = (real *)dst;
+   const real *s = (const real *)src;
+   for (size_t i = 0; i < count; i++) {
+      d[i] *= s[i];
+   }
+}
+
+static void Lcliser_(reduce_max)(void *dst, const void *src, size_t count) {
+   real *d = (real *)dst;
+   const real *s = (const real *)src;
+   for (size_t i = 0; i < count; i++) {
+      if (s[i] > d[i]) d[i] = s[i];
+   }
+}
+
+static void Lcliser_(reduce_min)(void *dst, const void *src, size_t count) {
+   real *d = (real *)dst;
+   const real *s = (const real *)src;
+   for (size_t i = 0; i < count; i++) {
+      if (s[i] < d[i]) d[i] = s[i];
+   }
+}
+
+// in the same order as reduce_ops
+static reduce_fn_t Lcliser_(reduce_fns)[] = {
+   Lcliser_(reduce_sum),
+   Lcliser_(reduce_prod),
+   Lcliser_(reduce_max),
+   Lcliser_(reduce_min),
+};
+#endif
+
 static int Lcliser_(storage_write)(lua_State *L) {
    THStorage *storage = luaT_checkudata(L, 1, torch_Storage);
    int sock = luaL_checkinteger(L, 2);
@@ -207,9 +307,13 @@ static int Lcliser_(storage_write)(lua_State *L) {
    long header[2];
    header[0] = ELEMENT_SIZE;
    header[1] = storage->size;
-   int ret = sock_send_raw(L, sock, header, sizeof(header), copy_context);
+   iov_batch_t batch;
+   iov_batch_init(&batch, 1);
+   int ret = iov_batch_add(L, sock, &batch, header, sizeof(header), copy_context);
+   if (ret) return ret;
+   ret = Lcliser_(write_region)(L, sock, &batch, storage->data, storage->size, WIRE_FORMAT_NONE, copy_context);
    if (ret) return ret;
-   return Lcliser_(write_contiguous)(L, sock, storage->data, storage->size, copy_context);
+   return iov_batch_flush(L, sock, &batch, copy_context);
 }
 
 static int Lcliser_(storage_read)(lua_State *L) {
@@ -218,21 +322,88 @@ static int Lcliser_(storage_read)(lua_State *L) {
    copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
    long header[2];
    sock_recv_raw(L, sock, header, sizeof(header), copy_context);
+   if (header[0] != ELEMENT_SIZE || header[1] != storage->size) shm_reject(sock, header[0] * header[1], copy_context);
    if (header[0] != ELEMENT_SIZE) return luaL_error(L, "local (%ld) and remote (%ld) storage ELEMENT_SIZE do not match", ELEMENT_SIZE, header[0]);
    if (header[1] != storage->size) return luaL_error(L, "local (%ld) and remote (%ld) storage size do not match", storage->size, header[1]);
    return Lcliser_(read_contiguous)(L, sock, storage->data, storage->size, copy_context);
 }
 
-static int Lcliser_(tensor_write_noncontiguous_rcsv)(lua_State *L, int sock, THTensor *tensor, int dim, int nDim, long nDimStride, real *ptr, copy_context_t *copy_context) {
+// ranges are 1-based like narrow, only the count goes in the header so each
+// end can slice from its own offset, a shard lands wherever the receiver wants
+static void Lcliser_(check_range)(lua_State *L, long size, long *offset, long *count) {
+   *offset = luaL_checkinteger(L, 4);
+   *count = luaL_checkinteger(L, 5);
+   if (*offset < 1 || *count < 0 || *offset - 1 + *count > size) luaL_error(L, "range of %ld elements at %ld is out of bounds for %ld elements", *count, *offset, size);
+}
+
+static int Lcliser_(write_range)(lua_State *L, int sock, real *data, long size, int wire_format, copy_context_t *copy_context) {
+   long offset, count;
+   Lcliser_(check_range)(L, size, &offset, &count);
+#ifdef CLISER_IS_CUDA
+   // CUDA IPC hands over whole allocations, not slices of them
+   if (copy_context->use_fastpath) return luaL_error(L, "ranged transfers of CUDA tensors are not supported over CUDA IPC");
+#endif
+   long header[2];
+   header[0] = 0x400 | ((wire_format << 2) & 0xC) | ((ELEMENT_SIZE << 4) & 0xF0);
+   header[1] = count;
+   iov_batch_t batch;
+   iov_batch_init(&batch, 1);
+   int ret = iov_batch_add(L, sock, &batch, header, sizeof(header), copy_context);
+   if (ret) return ret;
+   ret = Lcliser_(write_region)(L, sock, &batch, data + offset - 1, count, wire_format, copy_context);
+   if (ret) return ret;
+   return iov_batch_flush(L, sock, &batch, copy_context);
+}
+
+static int Lcliser_(read_range)(lua_State *L, int sock, real *data, long size, copy_context_t *copy_context) {
+   long offset, count;
+   Lcliser_(check_range)(L, size, &offset, &count);
+#ifdef CLISER_IS_CUDA
+   if (copy_context->use_fastpath) return luaL_error(L, "ranged transfers of CUDA tensors are not supported over CUDA IPC");
+#endif
+   long header[2];
+   int ret = sock_recv_raw(L, sock, header, sizeof(header), copy_context);
+   if (ret) return ret;
+   if (!(header[0] & 0x400)) return luaL_error(L, "remote did not send a range");
+   if (((header[0] & 0xF0) >> 4) != ELEMENT_SIZE) return luaL_error(L, "local(%ld) and remote(%ld) ELEMENT_SIZE mismatch", ELEMENT_SIZE, ((header[0] & 0xF0) >> 4));
+   if (header[1] != count) return luaL_error(L, "local(%ld) and remote(%ld) range count mismatch", count, header[1]);
+   int wire_format = (header[0] & 0xC) >> 2;
+   if (wire_format != WIRE_FORMAT_NONE) {
+#ifndef CLISER_WIRE_REAL
+      return luaL_error(L, "remote wire format(%d) is not supported for this tensor type", wire_format);
+#else
+      iov_batch_t batch;
+      iov_batch_init(&batch, 0);
+      return Lcliser_(read_region)(L, sock, &batch, data + offset - 1, count, wire_format, NULL, copy_context);
+#endif
+   }
+   return Lcliser_(read_contiguous)(L, sock, data + offset - 1, count, copy_context);
+}
+
+static int Lcliser_(storage_write_range)(lua_State *L) {
+   THStorage *storage = luaT_checkudata(L, 1, torch_Storage);
+   int sock = luaL_checkinteger(L, 2);
+   copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
+   return Lcliser_(write_range)(L, sock, storage->data, storage->size, WIRE_FORMAT_NONE, copy_context);
+}
+
+static int Lcliser_(storage_read_range)(lua_State *L) {
+   THStorage *storage = luaT_checkudata(L, 1, torch_Storage);
+   int sock = luaL_checkinteger(L, 2);
+   copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
+   return Lcliser_(read_range)(L, sock, storage->data, storage->size, copy_context);
+}
+
+static int Lcliser_(tensor_write_noncontiguous_rcsv)(lua_State *L, int sock, iov_batch_t *batch, THTensor *tensor, int dim, int nDim, long nDimStride, real *ptr, int wire_format, copy_context_t *copy_context) {
    if (dim == nDim) {
       for (long i = 0; i < tensor->size[dim]; i++) {
-         int ret = Lcliser_(write_contiguous)(L, sock, ptr, nDimStride, copy_context);
+         int ret = Lcliser_(write_region)(L, sock, batch, ptr, nDimStride, wire_format, copy_context);
          if (ret) return ret;
          ptr += tensor->stride[dim];
       }
    } else {
       for (long i = 0; i < tensor->size[dim]; i++) {
-         int ret = Lcliser_(tensor_write_noncontiguous_rcsv)(L, sock, tensor, dim + 1, nDim, nDimStride, ptr, copy_context);
+         int ret = Lcliser_(tensor_write_noncontiguous_rcsv)(L, sock, batch, tensor, dim + 1, nDim, nDimStride, ptr, wire_format, copy_context);
          if (ret) return ret;
          ptr += tensor->stride[dim];
       }
@@ -240,16 +411,16 @@ static int Lcliser_(tensor_write_noncontiguous_rcsv)(lua_State *L, int sock, THT
    return 0;
 }
 
-static int Lcliser_(tensor_read_noncontiguous_rcsv)(lua_State *L, int sock, THTensor *tensor, int dim, int nDim, long nDimStride, real *ptr, copy_context_t *copy_context) {
+static int Lcliser_(tensor_read_noncontiguous_rcsv)(lua_State *L, int sock, iov_batch_t *batch, THTensor *tensor, int dim, int nDim, long nDimStride, real *ptr, int wire_format, reduce_fn_t reduce, copy_context_t *copy_context) {
    if (dim == nDim) {
       for (long i = 0; i < tensor->size[dim]; i++) {
-         int ret = Lcliser_(read_contiguous)(L, sock, ptr, nDimStride, copy_context);
+         int ret = Lcliser_(read_region)(L, sock, batch, ptr, nDimStride, wire_format, reduce, copy_context);
          if (ret) return ret;
          ptr += tensor->stride[dim];
       }
    } else {
       for (long i = 0; i < tensor->size[dim]; i++) {
-         int ret = Lcliser_(tensor_read_noncontiguous_rcsv)(L, sock, tensor, dim + 1, nDim, nDimStride, ptr, copy_context);
+         int ret = Lcliser_(tensor_read_noncontiguous_rcsv)(L, sock, batch, tensor, dim + 1, nDim, nDimStride, ptr, wire_format, reduce, copy_context);
          if (ret) return ret;
          ptr += tensor->stride[dim];
       }
@@ -257,6 +428,202 @@ static int Lcliser_(tensor_read_noncontiguous_rcsv)(lua_State *L, int sock, THTe
    return 0;
 }
 
+#ifndef CLISER_IS_CUDA
+// a block of rows, walked column first when the rows sit closer together than the columns
+static void Lcliser_(strided_gather)(real *block, real *data, long *bases, long rows, long cols, long col_stride, int by_column) {
+   if (!by_column) {
+      for (long r = 0; r < rows; r++) {
+         real *src = data + bases[r];
+         real *dst = block + r * cols;
+         for (long c = 0; c < cols; c++) {
+            dst[c] = src[c * col_stride];
+         }
+      }
+      return;
+   }
+   for (long r0 = 0; r0 < rows; r0 += STRIDED_TILE) {
+      long r1 = (r0 + STRIDED_TILE < rows) ? r0 + STRIDED_TILE : rows;
+      for (long c0 = 0; c0 < cols; c0 += STRIDED_TILE) {
+         long c1 = (c0 + STRIDED_TILE < cols) ? c0 + STRIDED_TILE : cols;
+         for (long c = c0; c < c1; c++) {
+            for (long r = r0; r < r1; r++) {
+               block[r * cols + c] = data[bases[r] + c * col_stride];
+            }
+         }
+      }
+   }
+}
+
+static void Lcliser_(strided_scatter)(real *block, real *data, long *bases, long rows, long cols, long col_stride, int by_column) {
+   if (!by_column) {
+      for (long r = 0; r < rows; r++) {
+         real *dst = data + bases[r];
+         real *src = block + r * cols;
+         for (long c = 0; c < cols; c++) {
+            dst[c * col_stride] = src[c];
+         }
+      }
+      return;
+   }
+   for (long r0 = 0; r0 < rows; r0 += STRIDED_TILE) {
+      long r1 = (r0 + STRIDED_TILE < rows) ? r0 + STRIDED_TILE : rows;
+      for (long c0 = 0; c0 < cols; c0 += STRIDED_TILE) {
+         long c1 = (c0 + STRIDED_TILE < cols) ? c0 + STRIDED_TILE : cols;
+         for (long c = c0; c < c1; c++) {
+            for (long r = r0; r < r1; r++) {
+               data[bases[r] + c * col_stride] = block[r * cols + c];
+            }
+         }
+      }
+   }
+}
+
+// a reduce folds the whole block in one call, the local values are gathered next to it first
+static void Lcliser_(strided_land)(real *block, real *folded, real *data, long *bases, long rows, long cols, long col_stride, int by_column, reduce_fn_t reduce) {
+   if (reduce) {
+      Lcliser_(strided_gather)(folded, data, bases, rows, cols, col_stride, by_column);
+      reduce(folded, block, rows * cols);
+      block = folded;
+   }
+   Lcliser_(strided_scatter)(block, data, bases, rows, cols, col_stride, by_column);
+}
+
+static int Lcliser_(strided_block)(lua_State *L, int sock, real *block, size_t count, int is_send, int wire_format, copy_context_t *copy_context) {
+   if (wire_format != WIRE_FORMAT_NONE) {
+      size_t ret = is_send ?
+         sock_send_wire(sock, block, count, ELEMENT_SIZE, wire_format, copy_context) :
+         sock_recv_wire(sock, block, count, ELEMENT_SIZE, wire_format, copy_context);
+      if (ret != count) return LUA_HANDLE_ERROR_STR(L, "failed to transfer the correct number of bytes");
+      return 0;
+   }
+   size_t len = count * ELEMENT_SIZE;
+   size_t ret = is_send ? sock_send(sock, block, len, copy_context) : sock_recv(sock, block, len, copy_context);
+   if (ret != len) return LUA_HANDLE_ERROR_STR(L, "failed to transfer the correct number of bytes");
+   return 0;
+}
+
+// tensors without a unit stride last dimension go through a block sized staging buffer in logical order
+static int Lcliser_(tensor_strided)(lua_State *L, int sock, THTensor *tensor, int is_send, int wire_format, reduce_fn_t reduce, copy_context_t *copy_context) {
+   long block_count = STRIDED_BLOCK_BYTES / sizeof(real);
+   int nDim = tensor->nDimension;
+   if (THTensor_(nElement)(tensor) == 0) return 0;
+   uint8_t *staging = (uint8_t *)get_staging(copy_context);
+   if (!staging) return LUA_HANDLE_ERROR(L, ENOMEM);
+   real *folded = (real *)staging;
+   real *block = (real *)(staging + STRIDED_BLOCK_OFFSET);
+   long *bases = (long *)(staging + STRIDED_BASES_OFFSET);
+   long *index = alloca(nDim * sizeof(long));
+   memset(index, 0, nDim * sizeof(long));
+   real *data = tensor->storage->data + tensor->storageOffset;
+   long cols = tensor->size[nDim - 1];
+   long col_stride = tensor->stride[nDim - 1];
+   long rows = THTensor_(nElement)(tensor) / cols;
+   int by_column = nDim > 1 && labs(tensor->stride[nDim - 2]) < labs(col_stride);
+   long offset = 0;
+   if (cols > block_count) {
+      for (long r = 0; r < rows; r++) {
+         for (long c0 = 0; c0 < cols; c0 += block_count) {
+            long n = (cols - c0 > block_count) ? block_count : cols - c0;
+            long base = offset + c0 * col_stride;
+            if (is_send) Lcliser_(strided_gather)(block, data, &base, 1, n, col_stride, 0);
+            int ret = Lcliser_(strided_block)(L, sock, block, n, is_send, wire_format, copy_context);
+            if (ret) return ret;
+            if (!is_send) Lcliser_(strided_land)(block, folded, data, &base, 1, n, col_stride, 0, reduce);
+         }
+         offset = strided_next_row(index, tensor->size, tensor->stride, nDim, offset);
+      }
+      return 0;
+   }
+   long block_rows = block_count / cols;
+   if (block_rows > STRIDED_BLOCK_ROWS) block_rows = STRIDED_BLOCK_ROWS;
+   for (long r = 0; r < rows; r += block_rows) {
+      long n = (rows - r > block_rows) ? block_rows : rows - r;
+      for (long i = 0; i < n; i++) {
+         bases[i] = offset;
+         offset = strided_next_row(index, tensor->size, tensor->stride, nDim, offset);
+      }
+      if (is_send) Lcliser_(strided_gather)(block, data, bases, n, cols, col_stride, by_column);
+      int ret = Lcliser_(strided_block)(L, sock, block, n * cols, is_send, wire_format, copy_context);
+      if (ret) return ret;
+      if (!is_send) Lcliser_(strided_land)(block, folded, data, bases, n, cols, col_stride, by_column, reduce);
+   }
+   return 0;
+}
+#endif
+
+#ifndef CLISER_IS_CUDA
+static size_t Lcliser_(sparse_row_len)(THTensor *tensor) {
+   return (tensor->nDimension > 1) ? THTensor_(nElement)(tensor) / tensor->size[0] : 1;
+}
+
+// dense unless sending only the nonzero elements or rows is less than half the size
+static int Lcliser_(sparse_mode)(real *ptr, long count, long row_len) {
+   if (count < SPARSE_MIN_ELEMENTS || count > UINT32_MAX) return SPARSE_NONE;
+   long nnz = 0;
+   long nnz_rows = 0;
+   for (long r = 0; r < count; r += row_len) {
+      long row_nnz = 0;
+      for (long j = 0; j < row_len; j++) {
+         row_nnz += (ptr[r + j] != 0);
+      }
+      nnz += row_nnz;
+      nnz_rows += (row_nnz != 0);
+   }
+   size_t dense = count * ELEMENT_SIZE;
+   size_t elements = nnz * (sizeof(uint32_t) + ELEMENT_SIZE);
+   size_t rows = (size_t)-1;
+   if (row_len > 1 && (row_len * ELEMENT_SIZE) + 16 <= SPARSE_BLOCK_BYTES) {
+      rows = nnz_rows * (sizeof(uint32_t) + (row_len * ELEMENT_SIZE));
+   }
+   if (rows <= elements && rows < dense / 2) return SPARSE_ROWS;
+   if (elements < dense / 2) return SPARSE_ELEMENTS;
+   return SPARSE_NONE;
+}
+
+static int Lcliser_(sparse_chunk)(lua_State *L, int sock, uint32_t n, uint32_t *index, uint8_t *values, size_t row_bytes, copy_context_t *copy_context) {
+   struct iovec iov[3];
+   iov[0].iov_base = &n;
+   iov[0].iov_len = sizeof(n);
+   iov[1].iov_base = index;
+   iov[1].iov_len = SPARSE_INDEX_BYTES(n);
+   iov[2].iov_base = values;
+   iov[2].iov_len = n * row_bytes;
+   size_t len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+   if (sock_sendv(sock, iov, n ? 3 : 1, copy_context) != (n ? len : sizeof(n))) return LUA_HANDLE_ERROR_STR(L, "failed to send the correct number of sparse bytes");
+   return 0;
+}
+
+static int Lcliser_(write_sparse)(lua_State *L, int sock, real *ptr, long count, long row_len, copy_context_t *copy_context) {
+   uint8_t *staging = (uint8_t *)get_staging(copy_context);
+   if (!staging) return LUA_HANDLE_ERROR(L, ENOMEM);
+   size_t row_bytes = row_len * ELEMENT_SIZE;
+   uint32_t max_n = (SPARSE_BLOCK_BYTES - 8) / (sizeof(uint32_t) + row_bytes);
+   uint32_t *index = (uint32_t *)staging;
+   uint8_t *values = staging + SPARSE_INDEX_BYTES(max_n);
+   uint32_t n = 0;
+   long rows = count / row_len;
+   for (long r = 0; r < rows; r++) {
+      real *row = ptr + (r * row_len);
+      long j = 0;
+      while (j < row_len && row[j] == 0) j++;
+      if (j == row_len) continue;
+      index[n] = r;
+      memcpy(values + (n * row_bytes), row, row_bytes);
+      n++;
+      if (n == max_n) {
+         int ret = Lcliser_(sparse_chunk)(L, sock, n, index, values, row_bytes, copy_context);
+         if (ret) return ret;
+         n = 0;
+      }
+   }
+   if (n) {
+      int ret = Lcliser_(sparse_chunk)(L, sock, n, index, values, row_bytes, copy_context);
+      if (ret) return ret;
+   }
+   return Lcliser_(sparse_chunk)(L, sock, 0, index, values, row_bytes, copy_context);
+}
+#endif
+
 static int Lcliser_(tensor_write)(lua_State *L) {
    THTensor *tensor = luaT_checkudata(L, 1, torch_Tensor);
    int sock = luaL_checkinteger(L, 2);
@@ -271,22 +638,48 @@ static int Lcliser_(tensor_write)(lua_State *L) {
 #endif
    long i = sizeof(long) * ((2 * tensor->nDimension) + 1);
    long *header = alloca(i);
-   header[0] = (bc & 0x1) | ((copy_context->use_fastpath << 1) & 0x2) | ((ELEMENT_SIZE << 4) & 0xF0);
+   int wire_format = Lcliser_(wire_format)(copy_context);
+   int sparse = SPARSE_NONE;
+#ifndef CLISER_IS_CUDA
+   long row_len = Lcliser_(sparse_row_len)(tensor);
+   if (bc && copy_context->use_sparse && (copy_context->features & FEATURE_SPARSE) && tensor->storage) {
+      sparse = Lcliser_(sparse_mode)(tensor->storage->data + tensor->storageOffset, ne, row_len);
+   }
+   // sparse values go at full precision
+   if (sparse != SPARSE_NONE) wire_format = WIRE_FORMAT_NONE;
+#endif
+   header[0] = (bc & 0x1) | ((copy_context->use_fastpath << 1) & 0x2) | ((wire_format << 2) & 0xC) | ((ELEMENT_SIZE << 4) & 0xF0) | ((sparse << 8) & 0x300);
    for (long j = 0; j < tensor->nDimension; j++) {
       header[(2 * j) + 1] = tensor->size[j];
       header[(2 * j) + 2] = tensor->stride[j];
    }
-   int ret = sock_send_raw(L, sock, header, i, copy_context);
+   iov_batch_t batch;
+   iov_batch_init(&batch, 1);
+   int ret = iov_batch_add(L, sock, &batch, header, i, copy_context);
    if (ret) return ret;
    if (bc) {
+#ifndef CLISER_IS_CUDA
+      if (sparse != SPARSE_NONE) {
+         ret = iov_batch_flush(L, sock, &batch, copy_context);
+         if (ret) return ret;
+         return Lcliser_(write_sparse)(L, sock, tensor->storage->data + tensor->storageOffset, ne, (sparse == SPARSE_ROWS) ? row_len : 1, copy_context);
+      }
+#endif
       if (tensor->storage) {
-         return Lcliser_(write_contiguous)(L, sock, tensor->storage->data + tensor->storageOffset, ne, copy_context);
-      } else {
-         return 0;
+         ret = Lcliser_(write_region)(L, sock, &batch, tensor->storage->data + tensor->storageOffset, ne, wire_format, copy_context);
+         if (ret) return ret;
       }
+      return iov_batch_flush(L, sock, &batch, copy_context);
    } else {
-      if (tensor->nDimension < 2) return luaL_error(L, "not implemented");
-      if (tensor->stride[tensor->nDimension - 1] != 1) return luaL_error(L, "not implemented");
+      if (tensor->nDimension < 2 || tensor->stride[tensor->nDimension - 1] != 1) {
+#ifdef CLISER_IS_CUDA
+         return luaL_error(L, "not implemented");
+#else
+         ret = iov_batch_flush(L, sock, &batch, copy_context);
+         if (ret) return ret;
+         return Lcliser_(tensor_strided)(L, sock, tensor, 1, wire_format, NULL, copy_context);
+#endif
+      }
       bc = tensor->size[tensor->nDimension - 1];
       i = tensor->nDimension - 2;
       while (i >= 0 && bc == tensor->stride[i]) {
@@ -294,13 +687,24 @@ static int Lcliser_(tensor_write)(lua_State *L) {
          i--;
       }
       if (i < 0) return luaL_error(L, "unreachable");
-      ret = Lcliser_(tensor_write_noncontiguous_rcsv)(L, sock, tensor, 0, i, bc, tensor->storage->data + tensor->storageOffset, copy_context);
+      ret = Lcliser_(tensor_write_noncontiguous_rcsv)(L, sock, &batch, tensor, 0, i, bc, tensor->storage->data + tensor->storageOffset, wire_format, copy_context);
       if (ret) return ret;
+      return iov_batch_flush(L, sock, &batch, copy_context);
    }
-   return 0;
 }
 
-static int Lcliser_(tensor_read)(lua_State *L) {
+// a header we cannot take still has a payload behind it, a dense one may be
+// sitting in shared memory with the sender waiting on our answer
+static void Lcliser_(tensor_reject)(int sock, long *header, int nDimension, copy_context_t *copy_context) {
+   if (!(header[0] & 0x1) || (header[0] & 0x30E)) return;
+   size_t len = (header[0] & 0xF0) >> 4;
+   for (int i = 0; i < nDimension; i++) {
+      len *= header[(2 * i) + 1];
+   }
+   shm_reject(sock, len, copy_context);
+}
+
+static int Lcliser_(tensor_recv)(lua_State *L, reduce_fn_t reduce) {
    THTensor *tensor = luaT_checkudata(L, 1, torch_Tensor);
    int sock = luaL_checkinteger(L, 2);
    copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
@@ -315,20 +719,48 @@ static int Lcliser_(tensor_read)(lua_State *L) {
    long i = sizeof(long) * ((2 * tensor->nDimension) + 1);
    long *header = alloca(i);
    sock_recv_raw(L, sock, header, i, copy_context);
+   if ((header[0] & 0x1) != bc || ((header[0] & 0xF0) >> 4) != ELEMENT_SIZE) Lcliser_(tensor_reject)(sock, header, tensor->nDimension, copy_context);
    if ((header[0] & 0x1) != bc) return luaL_error(L, "local(%ld) and remote(%ld) isContiguous mismatch", bc, header[0] & 0xF);
    if (((header[0] & 0x2) >> 1) != copy_context->use_fastpath) return luaL_error(L, "local(%ld) and remote(%ld) use_fastpath mismatch", bc, header[0] & 0xF);
    if (((header[0] & 0xF0) >> 4) != ELEMENT_SIZE) return luaL_error(L, "local(%ld) and remote(%ld) ELEMENT_SIZE mismatch", ELEMENT_SIZE, ((header[0] & 0xF0) >> 4));
+   int wire_format = (header[0] & 0xC) >> 2;
+   int sparse = (header[0] & 0x300) >> 8;
+#ifndef CLISER_WIRE_REAL
+   if (wire_format != WIRE_FORMAT_NONE) return luaL_error(L, "remote wire format(%d) is not supported for this tensor type", wire_format);
+#endif
    for (i = 0; i < tensor->nDimension; i++) {
+      if (header[(2 * i) + 1] != tensor->size[i] || header[(2 * i) + 2] != tensor->stride[i]) Lcliser_(tensor_reject)(sock, header, tensor->nDimension, copy_context);
       if (header[(2 * i) + 1] != tensor->size[i]) return luaL_error(L, "local(%ld) and remote(%ld) size of dimension(%d) mismatch", tensor->size[i], header[(2 * i) + 1], i);
       if (header[(2 * i) + 2] != tensor->stride[i]) return luaL_error(L, "local(%ld) and remote(%ld) stride of dimension(%d) mismatch", tensor->size[i], header[(2 * i) + 2], i);
    }
+   if (sparse != SPARSE_NONE) {
+#ifdef CLISER_IS_CUDA
+      return luaL_error(L, "sparse transfers are not supported for CUDA tensors");
+#else
+      if (!bc || !tensor->storage) return luaL_error(L, "sparse transfers need a contiguous tensor");
+      size_t row_len = (sparse == SPARSE_ROWS) ? Lcliser_(sparse_row_len)(tensor) : 1;
+      int skip_zeros = reduce == Lcliser_(reduce_sum);
+      if (sock_recv_sparse(sock, tensor->storage->data + tensor->storageOffset, ne, ELEMENT_SIZE, row_len, reduce, skip_zeros, copy_context) != (size_t)ne) return LUA_HANDLE_ERROR_STR(L, "failed to recv the correct number of sparse bytes");
+      return 0;
+#endif
+   }
    if (bc) {
       if (tensor->storage) {
+         if (wire_format != WIRE_FORMAT_NONE || reduce) {
+            iov_batch_t batch;
+            iov_batch_init(&batch, 0);
+            return Lcliser_(read_region)(L, sock, &batch, tensor->storage->data + tensor->storageOffset, ne, wire_format, reduce, copy_context);
+         }
          return Lcliser_(read_contiguous)(L, sock, tensor->storage->data + tensor->storageOffset, ne, copy_context);
       }
    } else {
-      if (tensor->nDimension < 2) return luaL_error(L, "not implemented");
-      if (tensor->stride[tensor->nDimension - 1] != 1) return luaL_error(L, "not implemented");
+      if (tensor->nDimension < 2 || tensor->stride[tensor->nDimension - 1] != 1) {
+#ifdef CLISER_IS_CUDA
+         return luaL_error(L, "not implemented");
+#else
+         return Lcliser_(tensor_strided)(L, sock, tensor, 0, wire_format, reduce, copy_context);
+#endif
+      }
       bc = tensor->size[tensor->nDimension - 1];
       i = tensor->nDimension - 2;
       while (i >= 0 && bc == tensor->stride[i]) {
@@ -336,17 +768,126 @@ static int Lcliser_(tensor_read)(lua_State *L) {
          i--;
       }
       if (i < 0) return luaL_error(L, "unreachable");
-      Lcliser_(tensor_read_noncontiguous_rcsv)(L, sock, tensor, 0, i, bc, tensor->storage->data + tensor->storageOffset, copy_context);
+      iov_batch_t batch;
+      iov_batch_init(&batch, 0);
+      int ret = Lcliser_(tensor_read_noncontiguous_rcsv)(L, sock, &batch, tensor, 0, i, bc, tensor->storage->data + tensor->storageOffset, wire_format, reduce, copy_context);
+      if (ret) return ret;
+      return iov_batch_flush(L, sock, &batch, copy_context);
    }
    return 0;
 }
 
+static int Lcliser_(tensor_read)(lua_State *L) {
+   return Lcliser_(tensor_recv)(L, NULL);
+}
+
+static int Lcliser_(tensor_recv_reduce)(lua_State *L) {
+#ifdef CLISER_IS_CUDA
+   return luaL_error(L, "recvReduce does not support CUDA tensors");
+#else
+   int op = luaL_checkoption(L, 4, "sum", reduce_ops);
+   return Lcliser_(tensor_recv)(L, Lcliser_(reduce_fns)[op]);
+#endif
+}
+
+static real *Lcliser_(flat_data)(lua_State *L, THTensor *tensor, long *size) {
+#ifdef CLISER_IS_CUDA
+   THCState *thc = getCutorchState(L);
+   if (!THTensor_(isContiguous)(thc, tensor)) luaL_error(L, "ranged transfers need a contiguous tensor");
+   *size = THTensor_(nElement)(thc, tensor);
+#else
+   if (!THTensor_(isContiguous)(tensor)) luaL_error(L, "ranged transfers need a contiguous tensor");
+   *size = THTensor_(nElement)(tensor);
+#endif
+   return tensor->storage ? tensor->storage->data + tensor->storageOffset : NULL;
+}
+
+static int Lcliser_(tensor_write_range)(lua_State *L) {
+   THTensor *tensor = luaT_checkudata(L, 1, torch_Tensor);
+   int sock = luaL_checkinteger(L, 2);
+   copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
+   long size;
+   real *data = Lcliser_(flat_data)(L, tensor, &size);
+   return Lcliser_(write_range)(L, sock, data, size, Lcliser_(wire_format)(copy_context), copy_context);
+}
+
+static int Lcliser_(tensor_read_range)(lua_State *L) {
+   THTensor *tensor = luaT_checkudata(L, 1, torch_Tensor);
+   int sock = luaL_checkinteger(L, 2);
+   copy_context_t *copy_context = (copy_context_t *)lua_touserdata(L, 3);
+   long size;
+   real *data = Lcliser_(flat_data)(L, tensor, &size);
+   return Lcliser_(read_range)(L, sock, data, size, copy_context);
+}
+
+static int Lcliser_(storage_async)(lua_State *L) {
+   THStorage *storage = luaT_checkudata(L, 1, torch_Storage);
+   async_op_t *op = (async_op_t *)lua_touserdata(L, 2);
+#ifdef CLISER_IS_CUDA
+   (void)storage;
+   (void)op;
+   lua_pushboolean(L, 0);
+#else
+   long *header = malloc(2 * sizeof(long));
+   header[0] = ELEMENT_SIZE;
+   header[1] = storage->size;
+   op->wire_format = WIRE_FORMAT_NONE;
+   op->header = header;
+   op->header_len = 2 * sizeof(long);
+   op->ptr = storage->data;
+   op->len = storage->size * ELEMENT_SIZE;
+   lua_pushboolean(L, 1);
+#endif
+   return 1;
+}
+
+static int Lcliser_(tensor_async)(lua_State *L) {
+   THTensor *tensor = luaT_checkudata(L, 1, torch_Tensor);
+   async_op_t *op = (async_op_t *)lua_touserdata(L, 2);
+#ifdef CLISER_IS_CUDA
+   (void)tensor;
+   (void)op;
+   lua_pushboolean(L, 0);
+#else
+   if (!THTensor_(isContiguous)(tensor)) {
+      lua_pushboolean(L, 0);
+      return 1;
+   }
+#ifdef CLISER_WIRE_REAL
+   op->wire_element_size = ELEMENT_SIZE;
+#else
+   op->wire_format = WIRE_FORMAT_NONE;
+#endif
+   op->element_size = ELEMENT_SIZE;
+   op->row_len = Lcliser_(sparse_row_len)(tensor);
+   long i = sizeof(long) * ((2 * tensor->nDimension) + 1);
+   long *header = malloc(i);
+   header[0] = 0x1 | ((op->use_fastpath << 1) & 0x2) | ((op->wire_format << 2) & 0xC) | ((ELEMENT_SIZE << 4) & 0xF0);
+   for (long j = 0; j < tensor->nDimension; j++) {
+      header[(2 * j) + 1] = tensor->size[j];
+      header[(2 * j) + 2] = tensor->stride[j];
+   }
+   op->header = header;
+   op->header_len = i;
+   op->ptr = tensor->storage ? tensor->storage->data + tensor->storageOffset : NULL;
+   op->len = THTensor_(nElement)(tensor) * ELEMENT_SIZE;
+   lua_pushboolean(L, 1);
+#endif
+   return 1;
+}
+
 void Lcliser_(Init)(lua_State *L) {
    if (luaT_pushmetatable(L, torch_Storage)) {
       lua_pushcfunction(L, Lcliser_(storage_read));
       lua_setfield(L, -2, "_cliser_read");
       lua_pushcfunction(L, Lcliser_(storage_write));
       lua_setfield(L, -2, "_cliser_write");
+      lua_pushcfunction(L, Lcliser_(storage_async));
+      lua_setfield(L, -2, "_cliser_async");
+      lua_pushcfunction(L, Lcliser_(storage_read_range));
+      lua_setfield(L, -2, "_cliser_read_range");
+      lua_pushcfunction(L, Lcliser_(storage_write_range));
+      lua_setfield(L, -2, "_cliser_write_range");
       lua_pop(L, 1);
    }
    if (luaT_pushmetatable(L, torch_Tensor)) {
@@ -354,6 +895,14 @@ void Lcliser_(Init)(lua_State *L) {
       lua_setfield(L, -2, "_cliser_read");
       lua_pushcfunction(L, Lcliser_(tensor_write));
       lua_setfield(L, -2, "_cliser_write");
+      lua_pushcfunction(L, Lcliser_(tensor_async));
+      lua_setfield(L, -2, "_cliser_async");
+      lua_pushcfunction(L, Lcliser_(tensor_recv_reduce));
+      lua_setfield(L, -2, "_cliser_recv_reduce");
+      lua_pushcfunction(L, Lcliser_(tensor_read_range));
+      lua_setfield(L, -2, "_cliser_read_range");
+      lua_pushcfunction(L, Lcliser_(tensor_write_range));
+      lua_setfield(L, -2, "_cliser_write_range");
       lua_pop(L, 1);
    }
 }
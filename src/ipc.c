@@ -98,6 +98,7 @@ static const struct luaL_Reg ipc_routines[] = {
    {"marshal", marshal_open},
    {"isDevel", ipc_is_devel},
    {"channel", channel_create},
+   {"netTiming", cliser_net_timing},
    {NULL, NULL}
 };
 
@@ -115,20 +116,30 @@ static const struct luaL_Reg workqueue_routines[] = {
 
 static const struct luaL_Reg server_routines[] = {
    {"close", cliser_server_close},
+   {"__gc", cliser_server_close},
    {"clients", cliser_server_clients},
    {"broadcast", cliser_server_broadcast},
+   {"gather", cliser_server_gather},
    {"recvAny", cliser_server_recv_any},
+   {"recvAll", cliser_server_recv_all},
    {"netStats", cliser_server_net_stats},
+   {"zeroCopy", cliser_server_zero_copy},
+   {"wireFormat", cliser_server_wire_format},
+   {"sparse", cliser_server_sparse},
    {NULL, NULL}
 };
 
 static const struct luaL_Reg server_client_routines[] = {
    {"send", cliser_server_send},
    {"recv", cliser_server_recv},
+   {"recvReduce", cliser_server_recv_reduce},
    {"tag", cliser_server_tag},
    {"id", cliser_server_id},
    {"close", cliser_server_client_close},
    {"address", cliser_server_client_address},
+   {"features", cliser_server_client_features},
+   {"cork", cliser_server_client_cork},
+   {"flush", cliser_server_client_flush},
    {NULL, NULL}
 };
 
@@ -137,10 +148,25 @@ static const struct luaL_Reg client_routines[] = {
    {"__gc", cliser_client_close},
    {"send", cliser_client_send},
    {"recv", cliser_client_recv},
+   {"recvReduce", cliser_client_recv_reduce},
    {"recvAsync", cliser_client_recv_async},
+   {"sendAsync", cliser_client_send_async},
    {"retain", cliser_client_retain},
    {"metatablename", cliser_client_metatablename},
    {"netStats", cliser_client_net_stats},
+   {"zeroCopy", cliser_client_zero_copy},
+   {"wireFormat", cliser_client_wire_format},
+   {"sparse", cliser_client_sparse},
+   {"features", cliser_client_features},
+   {"cork", cliser_client_cork},
+   {"flush", cliser_client_flush},
+   {NULL, NULL}
+};
+
+static const struct luaL_Reg client_handle_routines[] = {
+   {"wait", cliser_client_handle_wait},
+   {"test", cliser_client_handle_test},
+   {"__gc", cliser_client_handle_gc},
    {NULL, NULL}
 };
 
@@ -260,6 +286,12 @@ DLL_EXPORT int luaopen_libipc(lua_State *L) {
    lua_settable(L, -3);
    luaT_setfuncs(L, client_routines, 0);
    lua_pop(L, 1);
+   luaL_newmetatable(L, "ipc.client.handle");
+   lua_pushstring(L, "__index");
+   lua_pushvalue(L, -2);
+   lua_settable(L, -3);
+   luaT_setfuncs(L, client_handle_routines, 0);
+   lua_pop(L, 1);
    luaL_newmetatable(L, "ipc.map");
    lua_pushstring(L, "__index");
    lua_pushvalue(L, -2);
@@ -1,6 +1,7 @@
 #include "ringbuffer.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 ringbuffer_t* ringbuffer_create(size_t cb) {
    ringbuffer_t* rb = malloc(sizeof(ringbuffer_t));
@@ -19,9 +20,12 @@ void ringbuffer_destroy(ringbuffer_t* rb) {
    free(rb);
 }
 
-void ringbuffer_grow_by(ringbuffer_t *rb, size_t cb) {
+// leaves rb as it was if the bigger buffer cannot be had
+int ringbuffer_grow_by(ringbuffer_t *rb, size_t cb) {
    size_t new_cb = rb->cb + cb;
+   if (new_cb < rb->cb) return -ENOMEM;
    uint8_t *new_buf = malloc(new_cb);
+   if (!new_buf) return -ENOMEM;
    size_t rcb = ringbuffer_read(rb, new_buf, new_cb);
    free(rb->buf);
    rb->buf = new_buf;
@@ -31,6 +35,7 @@ void ringbuffer_grow_by(ringbuffer_t *rb, size_t cb) {
    rb->rcb = rcb;
    rb->saved_wp = 0;
    rb->saved_rcb = 0;
+   return 0;
 }
 
 static size_t min(size_t a, size_t b) {
@@ -101,6 +106,14 @@ void ringbuffer_reset_read_pos(struct ringbuffer_t* rb) {
    rb->rp = 0;
 }
 
+void ringbuffer_reset(struct ringbuffer_t* rb) {
+   rb->rp = 0;
+   rb->wp = 0;
+   rb->rcb = 0;
+   rb->saved_wp = 0;
+   rb->saved_rcb = 0;
+}
+
 void* ringbuffer_buf_ptr(struct ringbuffer_t* rb) {
    return rb->buf;
 }
@@ -16,13 +16,14 @@ typedef struct ringbuffer_t {
 
 ringbuffer_t* ringbuffer_create(size_t cb);
 void ringbuffer_destroy(ringbuffer_t* rb);
-void ringbuffer_grow_by(ringbuffer_t *rb, size_t cb);
+int ringbuffer_grow_by(ringbuffer_t *rb, size_t cb);
 size_t ringbuffer_write(ringbuffer_t* rb, const void* in, size_t cb);
 size_t ringbuffer_read(ringbuffer_t* rb, void* out, size_t cb);
 size_t ringbuffer_peek(ringbuffer_t* rb);
 void ringbuffer_push_write_pos(ringbuffer_t* rb);
 void ringbuffer_pop_write_pos(ringbuffer_t* rb);
 void ringbuffer_reset_read_pos(ringbuffer_t* rb);
+void ringbuffer_reset(ringbuffer_t* rb);
 void* ringbuffer_buf_ptr(ringbuffer_t* rb);
 ringbuffer_t* ringbuffer_clone(ringbuffer_t* rb);
 
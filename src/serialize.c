@@ -102,6 +102,8 @@ int rb_save(lua_State *L, int index, ringbuffer_t *rb, int oop, int upval) {
          return 0;
       }
       case LUA_TTABLE: {
+         // out of lua stack is not out of buffer, callers grow on -ENOMEM
+         if (!lua_checkstack(L, 3)) return -EOVERFLOW;
          int startsize = lua_gettop(L);
          RB_WRITE(L, rb, &type, sizeof(char));
          int top = lua_gettop(L);
@@ -268,7 +270,7 @@ static int rb_load_rcsv(lua_State *L, ringbuffer_t *rb, int is_key) {
    void *ptr, **pptr;
    int startsize;
 
-   if (!lua_checkstack(L, 1)) return -ENOMEM;
+   if (!lua_checkstack(L, 1)) return -EOVERFLOW;
    RB_READ(L, rb, &type, sizeof(type));
    switch (type) {
       case LUA_TNIL:
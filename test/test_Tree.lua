@@ -2,27 +2,38 @@ local test = require 'regress'
 local ipc = require 'libipc'
 local Tree = require 'ipc.Tree'
 
-local function testAllReduce(njobs, base, makeValue, reduce)
+-- Runs fn(tree, jobid, ...) on every node of an njobs tree, the root's result comes first
+local function runTree(njobs, base, fn, ...)
    local server, port = ipc.server('127.0.0.1')
-   local m = ipc.map(njobs - 1, function(njobs, base, port, makeValue, reduce, mapid)
+   local args = { n = select('#', ...), ... }
+   local m = ipc.map(njobs - 1, function(njobs, base, port, fn, args, mapid)
       local ipc = require 'libipc'
       local Tree = require 'ipc.Tree'
       local client = ipc.client('127.0.0.1', port)
       local jobid = mapid + 1
       local tree = Tree(jobid, njobs, base, nil, client, '127.0.0.1')
-      local value = makeValue(jobid)
-      local value = tree.allReduce(value, reduce)
-      return value
-   end, njobs, base, port, makeValue, reduce)
+      return fn(tree, jobid, (unpack or table.unpack)(args, 1, args.n))
+   end, njobs, base, port, fn, args)
    server:clients(njobs - 1, function(client) end)
    local tree = Tree(1, njobs, base, server, nil, '127.0.0.1', port)
-   local value = makeValue(1)
-   local final = tree.allReduce(value, reduce)
+   local final = fn(tree, 1, (unpack or table.unpack)(args, 1, args.n))
    local ret = { m:join() }
    table.insert(ret, 1, final)
    return ret
 end
 
+local function testAllReduce(njobs, base, makeValue, reduce, algorithm, chunkBytes, bucketBytes)
+   return runTree(njobs, base, function(tree, jobid, makeValue, reduce, algorithm, chunkBytes, bucketBytes)
+      tree.setChunkSize(chunkBytes)
+      if bucketBytes then
+         tree.setBucketSize(bucketBytes)
+      end
+      local value = makeValue(jobid)
+      local value = tree.allReduce(value, reduce, nil, algorithm)
+      return value
+   end, makeValue, reduce, algorithm, chunkBytes, bucketBytes)
+end
+
 test {
    testTreeNumbersBase2 = function()
       local ret = testAllReduce(8, 2,
@@ -84,6 +95,102 @@ test {
       end
    end,
 
+   testTreeTensorsBuiltinReduce = function()
+      local ret = testAllReduce(8, 2,
+         function(jobid)
+            return { torch.Tensor(100000):fill(jobid), torch.FloatTensor(10):fill(jobid), jobid }
+         end,
+         'sum')
+      test.mustBeTrue(#ret == 8, 'expected 8 results, not '..#ret)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv[1]:sum() == 3600000, 'expected final value of 3600000, not '..rv[1]:sum())
+         test.mustBeTrue(rv[2]:sum() == 360, 'expected final value of 360, not '..rv[2]:sum())
+         test.mustBeTrue(rv[3] == 36, 'expected final value of 36, not '..rv[3])
+      end
+      ret = testAllReduce(4, 2,
+         function(jobid)
+            return torch.Tensor(4, 5):fill(jobid):narrow(2, 2, 3)
+         end,
+         'max')
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv:min() == 4, 'expected final value of 4, not '..rv:min())
+      end
+   end,
+
+   testTreeRingAllReduce = function()
+      local ret = testAllReduce(5, 2,
+         function(jobid)
+            return { torch.Tensor(100003):fill(jobid), torch.FloatTensor(3):fill(jobid), jobid }
+         end,
+         'sum', 'ring')
+      test.mustBeTrue(#ret == 5, 'expected 5 results, not '..#ret)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv[1]:min() == 15 and rv[1]:max() == 15, 'expected every element to be 15')
+         test.mustBeTrue(rv[2]:sum() == 45, 'expected final value of 45, not '..rv[2]:sum())
+         test.mustBeTrue(rv[3] == 15, 'expected final value of 15, not '..rv[3])
+      end
+      ret = testAllReduce(4, 2,
+         function(jobid)
+            return torch.FloatTensor(1000):fill(jobid)
+         end,
+         function(a, b) return a + b end, 'ring')
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv:min() == 10 and rv:max() == 10, 'expected every element to be 10')
+      end
+   end,
+
+   testTreePipelinedAllReduce = function()
+      local ret = testAllReduce(8, 2,
+         function(jobid)
+            return { torch.Tensor(100003):fill(jobid), torch.FloatTensor(10, 10):fill(jobid), jobid }
+         end,
+         'sum', nil, 64 * 1024)
+      test.mustBeTrue(#ret == 8, 'expected 8 results, not '..#ret)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv[1]:min() == 36 and rv[1]:max() == 36, 'expected every element to be 36')
+         test.mustBeTrue(rv[2]:sum() == 3600, 'expected final value of 3600, not '..rv[2]:sum())
+         test.mustBeTrue(rv[3] == 36, 'expected final value of 36, not '..rv[3])
+      end
+      -- chunks smaller than the tensor and a reduction that makes new tensors
+      ret = testAllReduce(4, 2,
+         function(jobid)
+            return torch.FloatTensor(30, 10):fill(jobid)
+         end,
+         function(a, b) return a + b end, nil, 7 * 4)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv:min() == 10 and rv:max() == 10, 'expected every element to be 10')
+         test.mustBeTrue(rv:dim() == 2, 'expected the shape to be kept')
+      end
+   end,
+
+   testTreeBucketedAllReduce = function()
+      local function makeValue(jobid)
+         local value = { layers = { }, count = jobid, view = torch.Tensor(6, 5):fill(jobid):narrow(2, 2, 3) }
+         for i = 1,40 do
+            value.layers[i] = { weight = torch.Tensor(i, 3):fill(jobid), bias = torch.FloatTensor(i):fill(jobid) }
+         end
+         value.big = torch.Tensor(1000):fill(jobid)
+         return value
+      end
+      local function check(ret)
+         test.mustBeTrue(#ret == 8, 'expected 8 results, not '..#ret)
+         for _,rv in ipairs(ret) do
+            test.mustBeTrue(rv.count == 36, 'expected final value of 36, not '..rv.count)
+            test.mustBeTrue(rv.view:min() == 36 and rv.view:max() == 36, 'expected every element to be 36')
+            test.mustBeTrue(rv.big:min() == 36 and rv.big:max() == 36, 'expected every element to be 36')
+            for i,layer in ipairs(rv.layers) do
+               test.mustBeTrue(layer.weight:size(1) == i and layer.weight:size(2) == 3, 'expected the weight to keep its shape')
+               test.mustBeTrue(layer.weight:min() == 36 and layer.weight:max() == 36, 'expected every weight to be 36')
+               test.mustBeTrue(layer.bias:min() == 36 and layer.bias:max() == 36, 'expected every bias to be 36')
+            end
+         end
+      end
+      -- Several buckets of each type, with the big tensor on its own
+      check(testAllReduce(8, 2, makeValue, 'sum', nil, nil, 4096))
+      check(testAllReduce(8, 2, makeValue, function(a, b) return a + b end, nil, nil, 4096))
+      check(testAllReduce(8, 2, makeValue, 'sum', 'ring', nil, 4096))
+   end,
+
    testUnevenNumberOfSteps = function()
       local function expected(n, ni)
          local c = 0
@@ -165,4 +272,72 @@ test {
          test.mustBeTrue(rv == 1, 'expected final value of 1, not '..rv)
       end
    end,
+
+   testReduceScatterAllGather = function()
+      local njobs = 5
+      local base = 2
+      local function run(tree, jobid)
+         local value = torch.Tensor(1003):fill(jobid)
+         local shard = tree.reduceScatter(value, 'sum')
+         local ret = { shard:min(), shard:max(), shard:nElement() }
+         tree.allGather(value)
+         table.insert(ret, value)
+         return ret
+      end
+      local ret = runTree(njobs, base, run)
+      test.mustBeTrue(#ret == njobs, 'expected '..njobs..' results, not '..#ret)
+      local numElements = 0
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv[1] == 15 and rv[2] == 15, 'expected every shard element to be 15')
+         numElements = numElements + rv[3]
+         test.mustBeTrue(rv[4]:min() == 15 and rv[4]:max() == 15, 'expected every gathered element to be 15')
+      end
+      test.mustBeTrue(numElements == 1003, 'expected the shards to cover 1003 elements, not '..numElements)
+   end,
+
+   testGather = function()
+      local njobs = 6
+      local base = 2
+      local ret = runTree(njobs, base, function(tree, jobid)
+         local gathered = tree.gather({ jobid, torch.FloatTensor(7):fill(jobid) })
+         if jobid == 1 then
+            return gathered
+         end
+         return gathered == nil
+      end)
+      local final = table.remove(ret, 1)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv == true, 'expected only the root to get the gathered values')
+      end
+      test.mustBeTrue(#final == njobs, 'expected '..njobs..' values, not '..#final)
+      for i,rv in ipairs(final) do
+         test.mustBeTrue(rv[1] == i, 'expected node '..i..' to send '..i..', not '..rv[1])
+         test.mustBeTrue(rv[2]:min() == i and rv[2]:max() == i, 'expected node '..i..' to send a tensor of '..i)
+      end
+   end,
+
+   testAllReduceAsync = function()
+      local njobs = 4
+      local base = 2
+      local function run(tree, jobid)
+         local a = torch.Tensor(1000):fill(jobid)
+         local b = { torch.FloatTensor(10):fill(jobid), jobid }
+         local ha = tree.allReduceAsync(a, 'sum')
+         local hb = tree.allReduceAsync(b, function(x, y) return x + y end)
+         -- Wait out of order, the collectives still run in the order they were started
+         local rb = hb:wait()
+         ha:wait()
+         local ret = { a:min(), a:max(), rb[1]:sum(), rb[2], ha:test() }
+         tree.close()
+         return ret
+      end
+      local ret = runTree(njobs, base, run)
+      test.mustBeTrue(#ret == njobs, 'expected '..njobs..' results, not '..#ret)
+      for _,rv in ipairs(ret) do
+         test.mustBeTrue(rv[1] == 10 and rv[2] == 10, 'expected every element to be 10')
+         test.mustBeTrue(rv[3] == 100, 'expected final value of 100, not '..rv[3])
+         test.mustBeTrue(rv[4] == 10, 'expected final value of 10, not '..rv[4])
+         test.mustBeTrue(rv[5] == true, 'expected a waited handle to test as done')
+      end
+   end,
 }
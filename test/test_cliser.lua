@@ -92,6 +92,213 @@ test {
       server:close()
    end,
 
+   testServerGC = function()
+      -- servers that are never closed stop their accept threads when collected
+      for _ = 1,4 do
+         local server, port = ipc.server('127.0.0.1')
+         local client = ipc.client('127.0.0.1', port)
+         client:close()
+      end
+      collectgarbage()
+      collectgarbage()
+      local server = ipc.server('127.0.0.1')
+      server:close()
+      server:close()
+   end,
+
+   testUnixSocket = function()
+      for _,host in ipairs({ '/tmp/ipc-test-'..ipc.getpid(), '@ipc-test-'..ipc.getpid() }) do
+         if host:sub(1, 1) == '/' or not ipc.isOSX() then
+            local server = ipc.server('unix:'..host)
+            local m = ipc.map(1, function(host)
+               local ipc = require 'libipc'
+               local client = ipc.client('unix:'..host)
+               client:send("ping")
+               local t = torch.FloatTensor(10, 10)
+               client:recv(t)
+               assert(t:sum() == 100)
+               client:close()
+            end, host)
+            server:clients(1, function(client)
+               assert(client:recv() == "ping")
+               assert(client:address() == "unix")
+               client:send(torch.FloatTensor(10, 10):fill(1))
+            end)
+            m:join()
+            server:close()
+         end
+      end
+   end,
+
+   testUnixSocketSharedMemory = function()
+      local host = 'unix:/tmp/ipc-test-shm-'..ipc.getpid()
+      local server = ipc.server(host)
+      local m = ipc.map(1, function(host)
+         local ipc = require 'libipc'
+         local client = ipc.client(host)
+         local t = torch.FloatTensor(1024, 1024)
+         for i = 1,3 do
+            client:recv(t)
+            assert(t:sum() == i * 1024 * 1024)
+            client:send(t:mul(2))
+         end
+         if not ipc.isOSX() then
+            local stats = client:netStats()
+            assert(stats.tx.shm_bytes == 3 * t:nElement() * 4)
+            assert(stats.rx.shm_bytes == 3 * t:nElement() * 4)
+         end
+         client:close()
+      end, host)
+      server:clients(1, function(client)
+         local t = torch.FloatTensor(1024, 1024)
+         for i = 1,3 do
+            client:send(t:fill(i))
+            client:recv(t)
+            assert(t:sum() == 2 * i * 1024 * 1024)
+         end
+      end)
+      m:join()
+      server:close()
+   end,
+
+   testSharedMemoryLengthMismatch = function()
+      -- without shared memory the payload just sits unread in the socket
+      if ipc.isOSX() then
+         return
+      end
+      local host = 'unix:/tmp/ipc-test-shm-mismatch-'..ipc.getpid()
+      local server = ipc.server(host)
+      local m = ipc.map(1, function(host)
+         local ipc = require 'libipc'
+         local client = ipc.client(host)
+         -- the receiver turns down the payload, so the send fails instead of hanging
+         local ok = pcall(function() client:send(torch.FloatStorage(1024 * 1024)) end)
+         assert(not ok)
+         client:send(torch.FloatStorage(1024 * 1024):fill(3))
+         client:close()
+      end, host)
+      server:clients(1, function(client)
+         local ok, err = pcall(function() client:recv(torch.FloatStorage(512 * 1024)) end)
+         assert(not ok and string.find(err, "size do not match"))
+         -- both ends are still in step after the rejected transfer
+         local s = torch.FloatStorage(1024 * 1024)
+         client:recv(s)
+         assert(s[1] == 3 and s[s:size()] == 3)
+      end)
+      m:join()
+      server:close()
+   end,
+
+   testHandshakeFeatures = function()
+      local host = 'unix:/tmp/ipc-test-features-'..ipc.getpid()
+      local server = ipc.server(host)
+      local m = ipc.map(1, function(host)
+         local ipc = require 'libipc'
+         local client = ipc.client(host)
+         local features = client:features()
+         assert(features.version == 1)
+         assert(features.wire and features.sparse)
+         assert(features.shm == not ipc.isOSX())
+         client:send(features)
+         client:close()
+      end, host)
+      server:clients(1, function(client)
+         local features = client:features()
+         local remote = client:recv()
+         for k,v in pairs(remote) do
+            assert(features[k] == v, "both ends should agree on "..k)
+         end
+      end)
+      m:join()
+      server:close()
+      -- tcp never gets shared memory
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               assert(client:features().shm == false)
+            end)
+         end,
+         function(client)
+            local features = client:features()
+            assert(features.shm == false)
+            assert(features.version == 1)
+         end)
+   end,
+
+   testStreams = function()
+      local server,port = ipc.server()
+      local m = ipc.map(2, function(port)
+         local ipc = require 'libipc'
+         local client = ipc.client('127.0.0.1', port, { streams = 4 })
+         client:send("ping")
+         local t = torch.FloatTensor(1024, 1024)
+         client:recv(t)
+         assert(t:sum() == 1024 * 1024)
+         client:send(t:mul(2))
+         client:sendAsync(t):wait()
+         assert(client:recv() == "bye")
+         client:close()
+      end, port)
+      server:clients(2, function(client)
+         assert(client:recv() == "ping")
+      end)
+      server:broadcast(torch.FloatTensor(1024, 1024):fill(1))
+      server:clients(function(client)
+         local t = torch.FloatTensor(1024, 1024)
+         client:recv(t)
+         assert(t:sum() == 2 * 1024 * 1024)
+         client:recv(t:zero())
+         assert(t:sum() == 2 * 1024 * 1024)
+      end)
+      server:broadcast("bye")
+      m:join()
+      server:close()
+   end,
+
+   testBroadcastTensor = function()
+      local t0 = torch.randn(512, 1024)
+      testCSN(4, test,
+         function(server)
+            server:clients(4, function(client) end)
+            server:broadcast(t0)
+            server:broadcast(t0:narrow(2, 1, 512))
+            server:broadcast(t0:storage())
+         end,
+         function(client, t0)
+            local t1 = torch.DoubleTensor(512, 1024)
+            client:recv(t1)
+            assert(torch.all(torch.eq(t0, t1)), "should match after recv")
+            local t2 = torch.DoubleTensor(512, 1024):narrow(2, 1, 512)
+            client:recv(t2)
+            assert(torch.all(torch.eq(t0:narrow(2, 1, 512), t2)), "should match after recv")
+            local s1 = torch.DoubleStorage(t0:nElement())
+            client:recv(s1)
+            assert(torch.all(torch.eq(t0, torch.DoubleTensor(s1, 1, t0:size()))), "should match after recv")
+         end, t0)
+   end,
+
+   testManyClientsConnecting = function()
+      local server,port = ipc.server()
+      local m = ipc.map(32, function(port, mapid)
+         local ipc = require 'libipc'
+         local client = ipc.client('127.0.0.1', port, { streams = 1 + (mapid % 3) })
+         client:send(mapid)
+         assert(client:recv() == "bye")
+         client:close()
+      end, port)
+      local seen = { }
+      local n = server:clients(32, function(client)
+         seen[client:recv()] = true
+      end)
+      assert(n == 32)
+      for i = 1,32 do
+         assert(seen[i], "missing client "..i)
+      end
+      server:broadcast("bye")
+      m:join()
+      server:close()
+   end,
+
    testPingPong = function()
       testCS(test,
          function(server)
@@ -108,6 +315,39 @@ test {
          end)
    end,
 
+   testCorkFlush = function()
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               for i = 1,100 do
+                  local msg = client:recv()
+                  assert(msg.i == i, "expected message "..i)
+               end
+               assert(client:recv() == "ping", "expected a ping")
+               client:cork()
+               client:send("pong")
+               client:send(torch.randn(10))
+               client:flush()
+            end)
+         end,
+         function(client)
+            local before = client:netStats().tx.num_system_calls
+            client:cork()
+            for i = 1,100 do
+               client:send({ i = i, q = "order?" })
+            end
+            client:flush()
+            local calls = client:netStats().tx.num_system_calls - before
+            assert(calls <= 2, "expected the corked messages to go out together, saw "..calls.." system calls")
+            -- a recv sends anything still corked first
+            client:cork()
+            client:send("ping")
+            local m = client:recv()
+            assert(m == "pong", "expected a pong, saw: "..tostring(m))
+            client:recv(torch.randn(10))
+         end)
+   end,
+
    testPingPongAsync = function()
       testCS(test,
          function(server)
@@ -133,6 +373,48 @@ test {
          end)
    end,
 
+   testLargeMessage = function()
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local msg = client:recv()
+               assert(#msg.s == 100000, "expected the whole string")
+               assert(#msg.t == 10000, "expected the whole table")
+               msg.t[10000] = -1
+               client:send(msg)
+            end)
+         end,
+         function(client)
+            local t = { }
+            for i = 1,10000 do
+               t[i] = i
+            end
+            client:send({ s = string.rep("x", 100000), t = t })
+            local msg = client:recv()
+            assert(#msg.s == 100000, "expected the whole string")
+            assert(msg.t[9999] == 9999 and msg.t[10000] == -1, "expected the whole table")
+         end)
+   end,
+
+   testDeeplyNestedMessage = function()
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               assert(client:recv() == "still connected")
+            end)
+         end,
+         function(client)
+            local t = { }
+            for _ = 1,100000 do
+               t = { t }
+            end
+            -- running out of lua stack is an error, not a reason to grow the buffer
+            local ok = pcall(function() client:send(t) end)
+            assert(ok == false, "expected a message nested this deep to fail")
+            client:send("still connected")
+         end)
+   end,
+
    testBroadcast = function()
       testCSN(10, test,
          function(server)
@@ -172,6 +454,130 @@ test {
          end)
    end,
 
+   testRecvAnyLargeMessages = function()
+      testCSN(4, test,
+         function(server)
+            local id = 0
+            server:clients(4, function(client)
+               id = id + 1
+               client:id(id)
+               client:send(id)
+            end)
+            -- the big messages arrive in pieces across calls, each client's stay in order
+            local seen = { }
+            for i = 1,8 do
+               local msg, client = server:recvAny()
+               local id = client:id()
+               if seen[id] then
+                  assert(msg == "done")
+               else
+                  assert(#msg == 1024 * 1024 and msg:sub(1, 1) == tostring(id))
+                  seen[id] = true
+               end
+            end
+            server:broadcast("bye")
+         end,
+         function(client)
+            local id = client:recv()
+            client:send(string.rep(tostring(id), 1024 * 1024))
+            client:send("done")
+            assert(client:recv() == "bye")
+         end)
+   end,
+
+   testGather = function()
+      testCSN(4, test,
+         function(server)
+            local id = 0
+            server:clients(4, function(client)
+               id = id + 1
+               client:id(id)
+               client:send(id)
+            end)
+            local tensors = { }
+            for i = 1,4 do
+               tensors[i] = torch.FloatTensor(256, 1024)
+            end
+            assert(server:gather(tensors) == 4)
+            for i = 1,3 do
+               assert(tensors[i]:min() == i and tensors[i]:max() == i, "tensor "..i.." should come from client "..i)
+            end
+            -- the last client sends sparse, which takes the sequential path
+            assert(tensors[4]:sum() == 4 * 1025 and tensors[4][2][1] == 4)
+            local stats = server:netStats().ops.gather
+            assert(stats.count == 1)
+         end,
+         function(client)
+            local id = client:recv()
+            client:sparse(true)
+            -- arrive in reverse order
+            require('sys').sleep((4 - id) * 0.1)
+            local t = torch.FloatTensor(256, 1024):fill(id)
+            if id == 4 then
+               t:zero():select(1, 1):fill(id)
+               t[2][1] = id
+            end
+            client:send(t)
+         end)
+   end,
+
+   testRecvAll = function()
+      testCSN(10, test,
+         function(server)
+            local id = 0
+            server:clients(10, function(client)
+               id = id + 1
+               client:id(id)
+            end)
+            local expected = { }
+            local n = 0
+            local calls = 0
+            while n < 30 do
+               local msgs, clients = server:recvAll()
+               assert(#msgs > 0 and #msgs == #clients)
+               for i,msg in ipairs(msgs) do
+                  local id = clients[i]:id()
+                  expected[id] = (expected[id] or 0) + 1
+                  assert(msg == expected[id], "messages from one client should arrive in order")
+               end
+               n = n + #msgs
+               calls = calls + 1
+            end
+            assert(n == 30)
+            assert(calls <= 10, "expected each client's burst in a single recvAll, saw "..calls.." calls")
+         end,
+         function(client)
+            client:cork()
+            for i = 1,3 do
+               client:send(i)
+            end
+            client:flush()
+         end)
+   end,
+
+   testRecvAnyTagged = function()
+      testCSN(10, test,
+         function(server)
+            server:clients(10, function(client)
+               local tag = client:recv()
+               client:tag(tag)
+            end)
+            local num = server:clients(function(client) end, "2")
+            for i = 1,num do
+               local msg = server:recvAny("2")
+               assert(msg == "2")
+            end
+            server:broadcast("bye")
+         end,
+         function(client)
+            local tag = tostring(math.random(2))
+            client:send(tag)
+            client:send(tag)
+            local msg = client:recv()
+            assert(msg == "bye")
+         end)
+   end,
+
    testStoragePingPong = function()
       testCS(test,
          function(server)
@@ -191,6 +597,41 @@ test {
          end)
    end,
 
+   testRangedTransfer = function()
+      local t0 = torch.randn(8, 1000)
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               -- each shard lands at the start of a shard sized tensor
+               local shard = torch.DoubleTensor(2000)
+               client:recv(shard, 1, 2000)
+               assert(torch.all(torch.eq(shard, t0:view(-1):narrow(1, 3001, 2000))), "shard should match")
+               -- or back in its place in a full size one
+               local t1 = torch.zeros(8, 1000)
+               client:recv(t1, 3001, 2000)
+               assert(torch.all(torch.eq(t1:view(-1):narrow(1, 3001, 2000), shard)), "shard should be in place")
+               assert(t1:view(-1):narrow(1, 1, 3000):abs():sum() == 0, "the rest should be untouched")
+               local s = torch.ByteStorage(8):fill(0)
+               client:recv(s, 3, 4)
+               assert(s:string() == "\0\0pong\0\0")
+               client:send(shard)
+               local ok = pcall(function() client:recv(shard, 1, 2001) end)
+               assert(ok == false, "out of bounds should fail")
+               ok = pcall(function() client:recv(shard, 1, 1000) end)
+               assert(ok == false, "count mismatch should fail")
+            end)
+         end,
+         function(client, t0)
+            client:send(t0, 3001, 2000)
+            client:sendAsync(t0, 3001, 2000):wait()
+            client:send(torch.ByteStorage():string("ping pong"), 6, 4)
+            local t2 = torch.zeros(4000)
+            client:recvAsync(t2, 1001, 2000):wait()
+            assert(torch.all(torch.eq(t2:narrow(1, 1001, 2000), t0:view(-1):narrow(1, 3001, 2000))), "async shard should be in place")
+            client:send(t0, 1, 2000)
+         end, t0)
+   end,
+
    testCUDAStoragePingPong = function()
       if cutorch then
          local t0 = torch.randn(3, 3):float()
@@ -241,6 +682,36 @@ test {
       testT(torch.randn(5, 6, 7, 8):sub(2,4), torch.randn(5, 6, 7, 8):sub(2,4))
    end,
 
+   testNoncontiguousTensorManyRows = function()
+      testT(torch.randn(3000, 64):narrow(2, 9, 32), torch.randn(3000, 64):narrow(2, 9, 32))
+   end,
+
+   testTransposedTensor = function()
+      testT(torch.randn(300, 200):t(), torch.randn(300, 200):t())
+   end,
+
+   testStridedTensor1D = function()
+      testT(torch.randn(5000, 3):select(2, 2), torch.randn(5000, 3):select(2, 2))
+   end,
+
+   testStridedTensorLastDimension = function()
+      testT(torch.randn(6, 7, 8):transpose(1, 3):narrow(2, 2, 4), torch.randn(6, 7, 8):transpose(1, 3):narrow(2, 2, 4))
+   end,
+
+   testTransposedTensorRecvReduce = function()
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t = torch.Tensor(40, 30):fill(1):t()
+               client:recvReduce(t, 'sum')
+               assert(t:min() == 3 and t:max() == 3, "expected a sum of 3")
+            end)
+         end,
+         function(client)
+            client:send(torch.Tensor(40, 30):fill(2):t())
+         end)
+   end,
+
    testCUDATensor = function()
       if cutorch then
          testT(torch.randn(3, 4, 5):cuda(), torch.randn(3, 4, 5):cuda())
@@ -253,6 +724,171 @@ test {
       end
    end,
 
+   testTensorAsync = function()
+      local t0 = torch.randn(64, 32)
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t1 = torch.randn(64, 32)
+               client:recv(t1)
+               assert(torch.all(torch.eq(t0, t1)), "should match after recv")
+               client:send(t1:mul(2))
+            end)
+         end,
+         function(client, t0)
+            local h0 = client:sendAsync(t0)
+            local t1 = torch.randn(64, 32)
+            local h1 = client:recvAsync(t1)
+            h0:wait()
+            assert(h1:wait() == t1)
+            assert(h1:test() == true)
+            assert(torch.all(torch.eq(torch.mul(t0, 2), t1)), "should match after wait")
+         end, t0)
+   end,
+
+   testNoncontiguousTensorAsync = function()
+      local t0 = torch.randn(5, 6):sub(2,4, 2,5)
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t1 = torch.randn(5, 6):sub(2,4, 2,5)
+               client:recv(t1)
+               assert(torch.all(torch.eq(t0, t1)), "should match after recv")
+            end)
+         end,
+         function(client, t0)
+            client:sendAsync(t0):wait()
+         end, t0)
+   end,
+
+   testTensorZeroCopy = function()
+      local t0 = torch.randn(256, 1024)
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t1 = torch.randn(256, 1024)
+               client:recv(t1)
+               assert(torch.all(torch.eq(t0, t1)), "should match after recv")
+            end)
+         end,
+         function(client, t0)
+            -- false when the kernel has no MSG_ZEROCOPY, then there is nothing to check
+            local enabled = client:zeroCopy(64 * 1024)
+            client:send(t0)
+            if enabled then
+               local stats = client:netStats()
+               assert(stats.tx.zerocopy_bytes >= t0:nElement() * 8, "expected the tensor to go out zero copy")
+            end
+         end, t0)
+   end,
+
+   testTensorWireFormat = function()
+      -- values that fp16 and bf16 hold exactly
+      local t0 = torch.range(-64, 63):mul(0.5):view(16, 8)
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t1 = torch.DoubleTensor(16, 8)
+               client:recv(t1)
+               assert(torch.all(torch.eq(t0, t1)), "should match after recv")
+               local t2 = torch.FloatTensor(16, 16):zero()
+               client:recv(t2:narrow(2, 1, 8))
+               assert(torch.all(torch.eq(t0:float(), t2:narrow(2, 1, 8))), "should match after recv")
+               client:recv(t1:zero())
+               assert(torch.all(torch.eq(t0, t1)), "should match after sendAsync")
+               server:wireFormat('fp16')
+               client:send(t0)
+               server:wireFormat('none')
+            end)
+         end,
+         function(client, t0)
+            client:wireFormat('fp16')
+            client:send(t0)
+            client:wireFormat('bf16')
+            local t2 = torch.FloatTensor(16, 16):zero()
+            t2:narrow(2, 1, 8):copy(t0)
+            client:send(t2:narrow(2, 1, 8))
+            client:sendAsync(t0):wait()
+            local stats = client:netStats()
+            assert(stats.tx.num_bytes < 3 * t0:nElement() * 4)
+            client:wireFormat('none')
+            local t1 = torch.DoubleTensor(16, 8):zero()
+            client:recvAsync(t1):wait()
+            assert(torch.all(torch.eq(t0, t1)), "should match after recvAsync")
+         end, t0)
+   end,
+
+   testRecvReduce = function()
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local t = torch.Tensor(100000):fill(1)
+               client:recvReduce(t)
+               assert(t:min() == 3 and t:max() == 3, "expected a sum of 3")
+               client:recvReduce(t, 'prod')
+               assert(t:min() == 6 and t:max() == 6, "expected a product of 6")
+               client:recvReduce(t, 'max')
+               assert(t:min() == 7 and t:max() == 7, "expected a max of 7")
+               client:recvReduce(t, 'min')
+               assert(t:min() == 5 and t:max() == 5, "expected a min of 5")
+               local n = torch.IntTensor(6, 8):fill(1):narrow(2, 3, 4)
+               client:recvReduce(n, 'sum')
+               assert(n:min() == 3 and n:max() == 3, "expected a noncontiguous sum of 3")
+               local ok = pcall(function() client:recvReduce(torch.Tensor(10), 'avg') end)
+               assert(ok == false, "expected an unknown op to fail")
+            end)
+         end,
+         function(client)
+            client:send(torch.Tensor(100000):fill(2))
+            client:send(torch.Tensor(100000):fill(2))
+            client:send(torch.Tensor(100000):fill(7))
+            client:send(torch.Tensor(100000):fill(5))
+            client:send(torch.IntTensor(6, 8):fill(2):narrow(2, 3, 4))
+         end)
+   end,
+
+   testSparseTensor = function()
+      local function sparseRows()
+         local rows = torch.zeros(10000, 64)
+         rows[17]:fill(17)
+         rows[500]:fill(1)
+         rows[9000]:fill(9000)
+         return rows
+      end
+      testCS(test,
+         function(server)
+            server:clients(1, function(client)
+               local rows = torch.randn(10000, 64)
+               client:recv(rows)
+               assert(rows:ne(0):sum() == 3 * 64, "expected 3 nonzero rows")
+               assert(rows[17]:eq(17):all() and rows[9000]:eq(9000):all(), "expected the nonzero rows to match")
+               local elements = torch.randn(100000)
+               client:recv(elements)
+               assert(elements:ne(0):sum() == 2 and elements[5] == 5 and elements[99999] == -1, "expected 2 nonzero elements")
+               local sum = torch.Tensor(10000, 64):fill(1)
+               client:recvReduce(sum, 'sum')
+               assert(sum:sum() == (10000 * 64) + (18 * 64) + (9000 * 64), "expected the sparse rows to be added")
+               server:sparse(true)
+               client:send(sparseRows())
+            end)
+         end,
+         function(client, sparseRows)
+            client:sparse(true)
+            local elements = torch.zeros(100000)
+            elements[5] = 5
+            elements[99999] = -1
+            local before = client:netStats().tx.num_bytes
+            client:send(sparseRows())
+            client:send(elements)
+            local sent = client:netStats().tx.num_bytes - before
+            assert(sent < 8192, "expected only the nonzero values to be sent, saw "..sent.." bytes")
+            client:send(sparseRows())
+            local async = torch.randn(10000, 64)
+            client:recvAsync(async):wait()
+            assert(async:ne(0):sum() == 3 * 64, "expected 3 nonzero rows")
+         end, sparseRows)
+   end,
+
    testTensorZeroSized = function()
       local t0 = torch.randn(0)
       testCS(test,
@@ -306,4 +942,30 @@ test {
       client:close()
       server:close()
    end,
+
+   testNetStatsPercentiles = function()
+      local server,port = ipc.server()
+      local t = ipc.map(1, function(port)
+         local ipc = require 'libipc'
+         return ipc.client(port)
+      end, port)
+      server:clients(1, function(client) end)
+      local client = t:join()
+      test.mustBeTrue(ipc.netTiming(false) == false, 'expected timing to be off')
+      for i = 1,100 do
+         client:send(string.rep('x', i * 8))
+         local msg = server:recvAny()
+         assert(#msg == i * 8)
+      end
+      test.mustBeTrue(ipc.netTiming(true) == true, 'expected timing to be on')
+      local send = client:netStats().ops.send
+      test.mustBeTrue(send.count == 100, 'expected 100 sends, saw: '..tostring(send.count))
+      test.mustBeTrue(send.seconds.p50 <= send.seconds.p99 and send.seconds.p99 <= send.seconds.p999, 'expected ordered latency percentiles')
+      test.mustBeTrue(send.bytes.p50 >= 50 * 8 and send.bytes.p999 >= 100 * 8, 'expected message sizes to be recorded')
+      local recvAny = server:netStats().ops.recvAny
+      test.mustBeTrue(recvAny.count == 100, 'expected 100 recvAnys, saw: '..tostring(recvAny.count))
+      test.mustBeTrue(recvAny.bytes.p999 >= 100 * 8, 'expected recvAny sizes to be recorded')
+      client:close()
+      server:close()
+   end,
 }